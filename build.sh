@@ -19,20 +19,20 @@ MACHINE=`uname -m`
 RELEASE=`uname -r`
 case $SYSTEM in
 	Darwin)
-		CFLAGS="-g -Wall"
+		CFLAGS="-g -O2 -Wall"
 		;;
 	FreeBSD)
-		CFLAGS="-g -Wall"
-		LDFLAGS="-lm"
+		CFLAGS="-g -O2 -Wall"
+		LDFLAGS="-lm -lpthread"
 		;;
 	Linux)
 		RELEASE=glibc:`echo /lib/libc-*.so | sed -e 's/^.*-//' -e 's/\([0-9]\.[0-9]\).*\.so$/\1/'`
-		CFLAGS="-g -Wall"
-		LDFLAGS="-lm"
+		CFLAGS="-g -O2 -Wall"
+		LDFLAGS="-lm -lpthread -lrt"
 		;;
 	SunOS)
 		CFLAGS="-g"
-		LDFLAGS="-lm"
+		LDFLAGS="-lm -lpthread -lrt"
 		;;
 	*)
 		echo Building on unknown system: $SYSTEM
@@ -77,13 +77,24 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <inttypes.h>
 #include <unistd.h>
 #include <string.h>
 #include <math.h>
 #include <assert.h>
+#include <errno.h>
+#include <time.h>
 #include <sys/time.h>
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#endif /* _WIN32 */
 
 #ifdef _WIN32
 #include <windows.h>
@@ -91,12 +102,28 @@
 #else /* _WIN32 */
 #include "replgetopt.h"
 #endif /* _WIN32 */
+#ifdef	SLJ_LIBRARY
+#include "sljtest.h"
+#endif	/* SLJ_LIBRARY */
 
-#ifdef	CPU_AFFINITY
-#define	__USE_GNU
+/* CPU affinity uses the Linux sched_setaffinity() interface */
+#if defined(__linux__) && !defined(CPU_AFFINITY)
+#define	CPU_AFFINITY
+#endif	/* __linux__ */
+
+#ifdef	__linux__
 #include <sched.h>
-#include "bitmask.h"
-#endif	/* CPU_AFFINITY */
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif	/* __linux__ */
+
+/* Vector analysis kernels need GCC-style target attributes and intrinsics */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define	SIMD_KERNELS
+#include <immintrin.h>
+#endif	/* __GNUC__ */
 
 #if defined(_WIN32)
 #include <sys/timeb.h>
@@ -146,7 +173,147 @@ int getopt(int, char *const *, const char *);
 #define	DEF_SUM			0
 /*! DEFault maximum output LINE WIDth */
 #define	DEF_LINEWID		79
+/*! DEFault memory LOCKing with mlockall() */
+#define	DEF_LOCK		0
+/*! DEFault HUGE page backing of buffers */
+#define	DEF_HUGE		0
+/*! DEFault SCHEDuling policy (NULL leaves policy alone) */
+#define	DEF_SCHED		NULL
+/*! DEFault real-time PRIOrity when a policy is requested */
+#define	DEF_PRIO		50
+/*! DEFault timer SLACK in nanoseconds (-1 leaves slack alone) */
+#define	DEF_SLACK		-1
+
+/*! DEFault analysis KERNEL (NULL picks the best the CPU supports) */
+#define	DEF_KERNEL		NULL
+/*! DEFault GAP between outliers merged into one event (ticks) */
+#define	DEF_GAP			1000
+/*! DEFault flight recorder TRIGGER (ticks, 0 for no flight recorder) */
+#define	DEF_TRIGGER		0
+/*! DEFault flight recorder CONTEXT before and after a trigger (deltas) */
+#define	DEF_CONTEXT		1000
+/*! DEFault flight RECORD file */
+#define	DEF_RECORD		"sljtest-flight.txt"
+
+/*! Number of rows in each AGGregate ranking table */
+#define	AGG_ROWS		20
+/*! Robust z-score above which a host is flagged as an AGGregate OUTLIER */
+#define	AGG_OUTLIER_Z		3.5
+/*! Largest difference in TSC rate from the reference for AGGregate merging (%) */
+#define	AGG_TPNS_PCT		1.0
+/*! Stack size for AGGregate reader threads (bytes) */
+#define	AGG_STACK		(256*1024)
+
+/*! Milliseconds spent CALIBRATING the TSC against time of day */
+#define	CALIBRATE_MS		100
+/*! Width of lag bins used to look for REPLAY PERIODicity (ms) */
+#define	REPLAY_PERIOD_BIN	0.05
+/*! Longest lag searched for REPLAY PERIODicity (ms) */
+#define	REPLAY_PERIOD_MAX	1000.0
+/*! Minimum strength over random for a REPLAY PERIOD to be reported */
+#define	REPLAY_PERIOD_MIN	3.0
+/*! Outliers closer than this REPLAY BURST GAP are one burst for periodicity (ms) */
+#define	REPLAY_BURST_GAP	1.0
+
+/*! Number of DELTAS in each BLOCK of timestamps */
+#define	BLOCK_DELTAS		10
+
+/*! Number of DELTAS in each TRACE CHUNK, always a whole number of blocks */
+#define	TRACE_CHUNK_DELTAS	(BLOCK_DELTAS*6400)
+/*! Number of TRACE CHUNKS in the ring between the timing and writer threads */
+#define	TRACE_CHUNKS		32
+/*! Milliseconds the TRACE writer sleeps when POLLing an empty ring */
+#define	TRACE_POLL_MS		1
+/*! Milliseconds between LIVE display frames */
+#define	LIVE_MS			1000
+/*! Milliseconds between effective FREQuency samples */
+#define	FREQ_MS			100
+/*! Change in effective FREQuency between samples counted as a transition (%) */
+#define	FREQ_STEP_PCT		2
+/*! Model specific register counting at the Actual core clock while running */
+#define	MSR_APERF		0xE8
+/*! Model specific register counting at the Maximum (TSC) rate while running */
+#define	MSR_MPERF		0xE7
+/*! Number of 1 ms ROLLup WINDOWS kept */
+#define	ROLL_MS_WINDOWS		1000
+/*! Number of 1 s ROLLup WINDOWS kept */
+#define	ROLL_S_WINDOWS		3600
+/*! Number of 1 min ROLLup WINDOWS kept */
+#define	ROLL_MIN_WINDOWS	1440
+/*! Number of Flight Record SLOTS waiting to be written */
+#define	FR_SLOTS		8
+/*! Milliseconds between Flight Recorder SNAPshots while waiting for a trigger */
+#define	FR_SNAP_MS		10
+/*! Shortest run of repeated deltas that TRACE encoding codes as a RUN */
+#define	TRACE_RUN_MIN		3
+/*! Longest Huffman code used in TRACE chunks (bits) */
+#define	TRACE_CODE_MAX		15
+/*! TRACE symbol for a delta too big to be its own symbol */
+#define	TRACE_SYM_ESC		254
+/*! TRACE symbol for a run repeating the previous delta */
+#define	TRACE_SYM_RUN		255
+
+/*! Number of DELTAS in each synthetic BENCHmark stream, a whole number of blocks */
+#define	BENCH_DELTAS		(BLOCK_DELTAS*100000)
+/*! Number of PASSES over each BENCHmark stream, the fastest is reported */
+#define	BENCH_PASSES		10
+/*! Number of BLOCKS timed to measure BENCHmark timing and loop overhead */
+#define	BENCH_BLOCKS		100000
+
+/*! Maximum number of C-states read from cpuidle */
+#define	CSTATE_MAX		10
+/*! Number of wakeups timed for each C-state probe idle duration, odd for a median */
+#define	CSTATE_REPS		21
+/*! Most blocks taken looking for a clean one after a C-state probe wakeup */
+#define	CSTATE_RECOVER_BLOCKS	100000
+
+/*! Bytes in the message hashed by the WORK unit */
+#define	WORK_MSG_BYTES		256
+/*! Most characters in each NUMber parsed by the WORK unit, with sign and comma */
+#define	WORK_NUM_CHARS		12
+/*! Number of WORK units timed to CALIBRATE the histogram, odd for a median */
+#define	WORK_CALIBRATE		1001
+
+/*! Milliseconds between publishes to the SHared Memory export */
+#define	SHM_MS			10
+/*! Number of recent OUTLIERS in the SHared Memory export, a power of 2 */
+#define	SHM_OUTLIERS		64
+/*! Times a SHared Memory reader RETRIES a snapshot torn by the writer */
+#define	SHM_RETRIES		1000
+
+/*! Length of each list of names in the isolation AUDIT (bytes) */
+#define	AUDIT_NAMES		160
+
+/*! Minimum delta above which RDTSC is reported as likely TRAPped (ticks) */
+#define	RDTSC_TRAP_TICKS	300
+
+/*! Size of an explicit HUGE PAGE (bytes), used to round MAP_HUGETLB requests */
+#define	HUGE_PAGE_SIZE		(2*1024*1024)
+
+#ifdef	TSC_REPLAY
+#ifdef	_WIN32
+#error "TSC_REPLAY needs trace files, which are not supported on this platform"
+#endif	/* _WIN32 */
+/*! Ticks per nanosecond of synthetic TSC REPLAY streams */
+#define	TSC_REPLAY_TPNS		2.0
+/*! Ticks each read of the time of day takes on the TSC REPLAY clock */
+#define	TSC_REPLAY_TOD_TICKS	100
+
+uint64_t tsc_replay_next();
+void tsc_replay_tod(struct timeval *tv);
+
+/*! \brief Read value of replayed TSC into a uint64_t
+ *  \param x A uint64_t to receive the TSC value
+ */
+#define rdtsc(x) \
+	do { \
+		x = tsc_replay_next(); \
+	} while (0)
+
+/*! Time of day follows the replayed TSC so runs are deterministic */
+#define	gettimeofday(tv, tz)	tsc_replay_tod(tv)
 
+#else	/* TSC_REPLAY */
 /*! \brief Read value of TSC into a uint64_t
  *  \param x A uint64_t to receive the TSC value
  */
@@ -156,6 +323,54 @@ int getopt(int, char *const *, const char *);
 		asm volatile ("rdtsc" : "=a" (lo), "=d" (hi)); \
 		x = (uint64_t)hi << 32 | lo; \
 	} while (0)
+#endif	/* TSC_REPLAY */
+
+/*! \brief Take a block of 11 timestamps and store their 10 differences
+ *  \param d       A uint64_t[BLOCK_DELTAS] to receive the deltas
+ *  \param first   A uint64_t to receive the first timestamp
+ *  \param last    A uint64_t to receive the last timestamp
+ *  \param between Statement run between timestamps, (void)0 for none
+ *
+ * The loop is unrolled so there's no branching or other work between
+ * timestamps; the test, the benchmark, and the CPU scan all use this one.
+ */
+#define ts_block(d, first, last, between) \
+	do { \
+		register uint64_t s0, s1, s2, s3, s4, s5, s6, s7, s8, s9, s10; \
+		rdtsc(s0);  between; \
+		rdtsc(s1);  between; \
+		rdtsc(s2);  between; \
+		rdtsc(s3);  between; \
+		rdtsc(s4);  between; \
+		rdtsc(s5);  between; \
+		rdtsc(s6);  between; \
+		rdtsc(s7);  between; \
+		rdtsc(s8);  between; \
+		rdtsc(s9);  between; \
+		rdtsc(s10); \
+		(d)[0] = s1 -s0; \
+		(d)[1] = s2 -s1; \
+		(d)[2] = s3 -s2; \
+		(d)[3] = s4 -s3; \
+		(d)[4] = s5 -s4; \
+		(d)[5] = s6 -s5; \
+		(d)[6] = s7 -s6; \
+		(d)[7] = s8 -s7; \
+		(d)[8] = s9 -s8; \
+		(d)[9] = s10-s9; \
+		first = s0; \
+		last  = s10; \
+	} while (0)
+
+/*! \brief Execute CPUID
+ *  \param leaf Value for EAX selecting the leaf
+ *  \param sub  Value for ECX selecting the subleaf
+ *  \param r    A uint32_t[4] to receive EAX, EBX, ECX, and EDX
+ */
+#define cpuid(leaf, sub, r) \
+	asm volatile ("cpuid" \
+	    : "=a" ((r)[0]), "=b" ((r)[1]), "=c" ((r)[2]), "=d" ((r)[3]) \
+	    : "a" (leaf), "c" (sub))
 
 /*! Size of array a in elements */
 #define	ARRAY_SIZE(a) (sizeof(a)/sizeof(a[0]))
@@ -184,6 +399,66 @@ typedef struct args_stct {
 	int sum;
 /*! Output line width (characters) */
 	size_t linewid;
+/*! Lock all memory with mlockall() before timing */
+	int lock;
+/*! Back buffers with huge pages */
+	int huge;
+/*! Scheduling policy name (fifo, rr, or other) */
+	char *sched;
+/*! Real-time scheduling priority */
+	int prio;
+/*! Timer slack (nanoseconds) */
+	long slack;
+/*! Analysis kernel name (scalar, avx2, or avx512) */
+	char *kernel;
+/*! Snapshot file to save results in */
+	char *save;
+/*! Snapshot file to load and report instead of testing */
+	char *load;
+/*! Directory of snapshot files to aggregate instead of testing */
+	char *aggregate;
+/*! Outlier file to replay instead of testing */
+	char *replay;
+/*! Ticks per nanosecond for replay (0 to calibrate) */
+	double tpns;
+/*! Trace file to record every delta in */
+	char *trace;
+/*! Trace file to decode and print instead of testing */
+	char *dump_trace;
+/*! Largest gap between outliers merged into one event (ticks) */
+	uint64_t gap;
+/*! EVENTS file where merged outlier events are written */
+	char *events;
+/*! Delta that triggers a flight record (ticks, 0 for none) */
+	uint64_t trigger;
+/*! Deltas saved before and after each trigger */
+	uint64_t context;
+/*! Flight RECORD file */
+	char *record;
+/*! Redraw the histogram live while testing */
+	int live;
+/*! File where rollup time SERIES are written */
+	char *series;
+/*! Benchmark the analysis engine instead of testing */
+	int bench;
+/*! File where effective FREQuency per interval is written */
+	char *freq;
+/*! Idle method for the C-state probe instead of testing */
+	char *cstates;
+/*! Scan and rank every CPU instead of testing */
+	int scan;
+/*! Audit isolation of the measured CPUs */
+	int audit;
+/*! Work unit timed between timestamps */
+	char *work;
+/*! Name of SHared Memory segment to publish results in */
+	char *shm;
+/*! Name of shared memory segment to read and report instead of testing */
+	char *peek;
+/*! Start each block on a fixed-rate deadline this far apart (microseconds, 0 for none) */
+	double interval;
+/*! Correct paced runs for coordinated omission */
+	int correct;
 } args_t;
 
 /*! Type for histogram table */
@@ -196,12 +471,308 @@ typedef struct bin_stct {
 	uint64_t delta_sum;
 } bin_t;
 
+/*! Type for exact sums of squared deltas */
+#ifdef	__SIZEOF_INT128__
+typedef unsigned __int128 sumsq_t;
+#else	/* __SIZEOF_INT128__ */
+typedef long double sumsq_t;	/* Not exact, but close on 32-bit builds */
+#endif	/* __SIZEOF_INT128__ */
+
+/*!
+ * \brief Type for statistics over all deltas
+ *
+ * Moments are kept as exact integer sums so that mean and variance can be
+ * computed once at the end, and so statistics can be merged by adding.
+ */
+typedef struct stats_stct {
+/*! Minimum delta (ticks) */
+	uint64_t min;
+/*! Maximum delta (ticks) */
+	uint64_t max;
+/*! Count of deltas */
+	uint64_t count;
+/*! Sum of deltas (ticks) */
+	uint64_t sum;
+/*! Sum of squared deltas (ticks^2) */
+	sumsq_t sumsq;
+} stats_t;
+
+/*! Type for the results of a test run: everything needed to report on it */
+typedef struct results_stct {
+/*! Histogram table */
+	bin_t *histo;
+/*! Number of bins in histogram table */
+	uint64_t bins;
+/*! Statistics over all deltas */
+	stats_t stats;
+/*! Ticks per nanosecond measured over the run */
+	double tpns;
+/*! TSC ticks actually spent in timing measurements */
+	uint64_t timing_ticks;
+/*! TSC ticks for the whole run */
+	uint64_t run_ticks;
+/*! Microseconds for the whole run */
+	uint64_t run_us;
+} results_t;
+
+/*! Magic string at the start of every snapshot file */
+#define	SNAP_MAGIC		"SLJSNAP"
+/*! Snapshot format version, bumped whenever the layout changes */
+#define	SNAP_VERSION		1
+
+/*!
+ * \brief Type for the header of a binary snapshot file
+ *
+ * A snapshot is this header followed by the histogram table at offset
+ * bins_off.
+ * All fields have fixed sizes and the histogram is 8-byte aligned, so a
+ * mapped snapshot is used in place without parsing.
+ */
+typedef struct snap_stct {
+/*! SNAP_MAGIC, NUL padded */
+	char magic[8];
+/*! SNAP_VERSION when written */
+	uint32_t version;
+/*! Size of this header (bytes) */
+	uint32_t hdr_size;
+/*! Size of the whole file (bytes) */
+	uint64_t file_size;
+/*! Offset of the histogram table (bytes) */
+	uint64_t bins_off;
+/*! Number of histogram bins */
+	uint64_t bins;
+/*! Knee of histogram curve (ticks) */
+	uint64_t knee;
+/*! Minimum expected value (ticks) */
+	uint64_t min;
+/*! Runtime (seconds) */
+	int32_t runtime;
+/*! Pause before each block (milliseconds) */
+	int32_t pause;
+/*! Nonzero if outliers were logged to a file */
+	int32_t logged;
+/*! CPU the test ran on at the end, or -1 if unknown */
+	int32_t cpu;
+/*! Start of the run (seconds since the epoch) */
+	uint64_t start_time;
+/*! Ticks per nanosecond measured over the run */
+	double tpns;
+/*! TSC ticks actually spent in timing measurements */
+	uint64_t timing_ticks;
+/*! TSC ticks for the whole run */
+	uint64_t run_ticks;
+/*! Microseconds for the whole run */
+	uint64_t run_us;
+/*! Minimum delta (ticks) */
+	uint64_t stat_min;
+/*! Maximum delta (ticks) */
+	uint64_t stat_max;
+/*! Count of deltas */
+	uint64_t stat_count;
+/*! Sum of deltas (ticks) */
+	uint64_t stat_sum;
+/*! Sum of squared deltas, low 64 bits */
+	uint64_t stat_sumsq_lo;
+/*! Sum of squared deltas, high 64 bits */
+	uint64_t stat_sumsq_hi;
+/*! Host name */
+	char host[64];
+/*! CPU model from CPUID brand string */
+	char cpu_model[64];
+/*! Version string of the writer */
+	char writer[32];
+/*! Command line of the run */
+	char cmdline[256];
+} snap_t;
+
+/*!
+ * \brief Type for an event: outliers close enough together to be one interruption
+ *
+ * Stolen ticks are sum less count times the minimum delta, computed once
+ * the minimum for the run is known.
+ */
+typedef struct event_stct {
+/*! TSC at the start of the first outlier */
+	uint64_t start;
+/*! TSC at the end of the last outlier */
+	uint64_t end;
+/*! Number of outlying deltas */
+	uint64_t count;
+/*! Sum of outlying deltas (ticks) */
+	uint64_t sum;
+} event_t;
+
+/*! Type for event size histogram table */
+typedef struct ebin_stct {
+/*! Upper Bound (inclusive) on total event ticks */
+	uint64_t ub;
+/*! Count of events in bin */
+	uint64_t events;
+/*! Count of outlying deltas in those events */
+	uint64_t deltas;
+/*! Sum of outlying deltas in those events (ticks) */
+	uint64_t sum;
+} ebin_t;
+
+/*! Type for the state of event merging */
+typedef struct events_stct {
+/*! Event being merged, count is 0 if none */
+	event_t cur;
+/*! Event size histogram, one bin per histogram bin above the knee */
+	ebin_t *histo;
+/*! Number of bins in histo */
+	uint64_t bins;
+/*! Ring buffer of recent events, or NULL if not writing events */
+	event_t *buf;
+/*! Next open entry in buf */
+	event_t *next;
+/*! True when buf wrapped around */
+	int didwrap;
+} events_t;
+
+/*! Type for statistics of one window of a rollup time series */
+typedef struct window_stct {
+/*! TSC at the start of the window */
+	uint64_t start;
+/*! TSC at the end of the window */
+	uint64_t end;
+/*! Largest delta, exact if there were outliers (ticks) */
+	uint64_t max;
+/*! 99.9th percentile, upper bound of its bin (ticks) */
+	uint64_t p999;
+/*! Number of outliers */
+	uint64_t outliers;
+/*! Ticks stolen by outliers in excess of the minimum delta */
+	uint64_t stolen;
+} window_t;
+
+/*! Type for one resolution of a rollup time series */
+typedef struct level_stct {
+/*! Name of window length, like "1ms" */
+	const char *name;
+/*! Windows of the next finer level per window, 1 for the finest */
+	uint64_t per;
+/*! Number of windows in ring */
+	uint64_t len;
+/*! Ring of the most recent windows */
+	window_t *ring;
+/*! Number of windows closed */
+	uint64_t n;
+/*! Histogram when the current window started */
+	bin_t *base;
+/*! TSC at the start of the current window */
+	uint64_t start;
+/*! Largest outlier in the current window, 0 if none */
+	uint64_t max;
+/*! Window with the largest max over the whole run */
+	window_t worst;
+} level_t;
+
+/*! Type for the state of the rollup time series */
+typedef struct rollup_stct {
+/*! 1 ms, 1 s, and 1 min levels, finest first */
+	level_t level[3];
+/*! Length of a finest window (ticks), 0 if not keeping rollups */
+	uint64_t ticks;
+/*! TSC at the end of the current finest window */
+	uint64_t deadline;
+/*! Ticks per nanosecond calibrated before the run */
+	double tpns;
+/*! Statistics being updated by the timing thread */
+	const stats_t *stats;
+/*! Scratch histogram for the change over a window */
+	bin_t *diff;
+/*! TSC at the start of the run */
+	uint64_t start;
+} rollup_t;
+
+/*! Magic string at the start of every shared memory export */
+#define	SHM_MAGIC		"SLJSHM"
+/*! Shared memory export layout version, bumped whenever the layout changes */
+#define	SHM_VERSION		2
+
+/*!
+ * \brief Type for the header of a shared memory export
+ *
+ * The segment is this header, the histogram table at snap.bins_off from
+ * snap, and the recent outlier ring at outliers_off from the start.
+ * So snap and the histogram after it are laid out like a snapshot file.
+ * Readers copy what they need, then check that seq is even and hasn't
+ * changed, or retry.
+ */
+typedef struct shm_hdr_stct {
+/*! SHM_MAGIC, NUL padded */
+	char magic[8];
+/*! SHM_VERSION when written */
+	uint32_t version;
+/*! Size of this header (bytes) */
+	uint32_t hdr_size;
+/*! Sequence count, odd while the writer is publishing */
+	uint64_t seq;
+/*! Size of the whole segment (bytes) */
+	uint64_t size;
+/*! Offset of the recent outlier ring (bytes) */
+	uint64_t outliers_off;
+/*! Number of entries in the recent outlier ring */
+	uint64_t outliers_len;
+/*! Number of outliers so far, outlier n is in entry n%outliers_len */
+	uint64_t outliers;
+/*! Number of times published */
+	uint64_t publishes;
+/*! TSC at the start of the run */
+	uint64_t start_tsc;
+/*! Process ID of the writer */
+	int32_t pid;
+/*! Nonzero once the run is over and the snapshot is final */
+	int32_t done;
+/*! Windows closed at each rollup resolution, 1 ms, 1 s, and 1 min, all 0 without --series */
+	uint64_t windows[3];
+/*! Last window closed at each rollup resolution */
+	window_t last[3];
+/*! Window with the largest max so far at each rollup resolution */
+	window_t worst[3];
+/*! Results so far, with the histogram following */
+	snap_t snap;
+} shm_hdr_t;
+
+/*! Magic string at the start of every trace file */
+#define	TRACE_MAGIC		"SLJTRAC"
+/*! Trace format version, bumped whenever the encoding changes */
+#define	TRACE_VERSION		1
+
+/*!
+ * \brief Type for the header of a trace file
+ *
+ * A trace is this header followed by encoded chunks of deltas.
+ * Counts and tpns are filled in when the run ends.
+ */
+typedef struct trace_hdr_stct {
+/*! TRACE_MAGIC, NUL padded */
+	char magic[8];
+/*! TRACE_VERSION when written */
+	uint32_t version;
+/*! Size of this header (bytes) */
+	uint32_t hdr_size;
+/*! Ticks per nanosecond measured over the run */
+	double tpns;
+/*! Knee of histogram curve (ticks) */
+	uint64_t knee;
+/*! Number of deltas in the trace */
+	uint64_t deltas;
+/*! Number of deltas dropped because the writer fell behind */
+	uint64_t dropped;
+/*! Number of encoded chunks */
+	uint64_t chunks;
+} trace_hdr_t;
+
 /*! Type for outlier buffer entry */
 typedef struct outlier_stct {
-/*! TSC when the outlier happended */
+/*! TSC at the start of the outlying delta */
 	uint64_t when;
 /*! Size of outlier (ticks) */
 	uint64_t delta;
+/*! Position of the outlying delta in its block (0 to BLOCK_DELTAS-1) */
+	int pos;
 } outlier_t;
 
 /*! Command line argument values */
@@ -218,69 +789,348 @@ args_t args = {
 	DEF_RUNTIME,
 	DEF_SUM,
 	DEF_LINEWID,
+	DEF_LOCK,
+	DEF_HUGE,
+	DEF_SCHED,
+	DEF_PRIO,
+	DEF_SLACK,
+	DEF_KERNEL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	0.0,
+	NULL,
+	NULL,
+	DEF_GAP,
+	NULL,
+	DEF_TRIGGER,
+	DEF_CONTEXT,
+	DEF_RECORD,
+	0,
+	NULL,
+	0,
+	NULL,
+	NULL,
+	0,
+	0,
+	NULL,
+	NULL,
+	NULL,
+	0.0,
+	0,
+};
+
+/*! Values returned by getopt_long() for options without a short form */
+enum longopt_vals {
+	OPT_KERNEL = 256,	/*!< --kernel */
+	OPT_SAVE,		/*!< --save */
+	OPT_LOAD,		/*!< --load */
+	OPT_AGGREGATE,		/*!< --aggregate */
+	OPT_REPLAY,		/*!< --replay */
+	OPT_TPNS,		/*!< --tpns */
+	OPT_TRACE,		/*!< --trace */
+	OPT_DUMP_TRACE,		/*!< --dump-trace */
+	OPT_GAP,		/*!< --gap */
+	OPT_EVENTS,		/*!< --events */
+	OPT_TRIGGER,		/*!< --trigger */
+	OPT_CONTEXT,		/*!< --context */
+	OPT_RECORD,		/*!< --record */
+	OPT_LIVE,		/*!< --live */
+	OPT_SERIES,		/*!< --series */
+	OPT_BENCH,		/*!< --selftest-bench */
+	OPT_FREQ,		/*!< --freq */
+	OPT_CSTATES,		/*!< --cstates */
+	OPT_SCAN,		/*!< --scan */
+	OPT_AUDIT,		/*!< --audit */
+	OPT_WORK,		/*!< --work */
+	OPT_SHM,		/*!< --shm */
+	OPT_PEEK,		/*!< --peek */
+	OPT_INTERVAL,		/*!< --interval */
+	OPT_CORRECT,		/*!< --correct */
 };
 
 /*! Command line options for getopt() */
 const struct option OptTable[] = {
+	{"aggregate",required_argument,NULL, OPT_AGGREGATE},
+	{"audit",         no_argument, NULL, OPT_AUDIT},
 	{"bins",    required_argument, NULL, 'b'},
+	{"context", required_argument, NULL, OPT_CONTEXT},
+	{"correct",       no_argument, NULL, OPT_CORRECT},
+	{"cstates", required_argument, NULL, OPT_CSTATES},
 #ifdef	CPU_AFFINITY
 	{"cpu",     required_argument, NULL, 'c'},
 #endif	/* CPU_AFFINITY */
+	{"dump-trace",required_argument,NULL,OPT_DUMP_TRACE},
+	{"events",  required_argument, NULL, OPT_EVENTS},
 	{"outfile", required_argument, NULL, 'f'},
+	{"freq",    required_argument, NULL, OPT_FREQ},
+	{"gap",     required_argument, NULL, OPT_GAP},
 	{"help",          no_argument, NULL, 'h'},
+	{"huge",          no_argument, NULL, 'H'},
+	{"interval",required_argument, NULL, OPT_INTERVAL},
+	{"kernel",  required_argument, NULL, OPT_KERNEL},
 	{"knee",    required_argument, NULL, 'k'},
+	{"load",    required_argument, NULL, OPT_LOAD},
+	{"live",          no_argument, NULL, OPT_LIVE},
+	{"lock",          no_argument, NULL, 'l'},
 	{"min",     required_argument, NULL, 'm'},
 	{"outbuf",  required_argument, NULL, 'o'},
 	{"pause",   required_argument, NULL, 'p'},
+	{"peek",    required_argument, NULL, OPT_PEEK},
+	{"replay",  required_argument, NULL, OPT_REPLAY},
+	{"priority",required_argument, NULL, 'P'},
+	{"record",  required_argument, NULL, OPT_RECORD},
 	{"runtime", required_argument, NULL, 'r'},
+	{"save",    required_argument, NULL, OPT_SAVE},
 	{"sum",           no_argument, NULL, 's'},
+	{"scan",          no_argument, NULL, OPT_SCAN},
+	{"sched",   required_argument, NULL, 'S'},
+	{"selftest-bench",no_argument, NULL, OPT_BENCH},
+	{"series",  required_argument, NULL, OPT_SERIES},
+	{"shm",     required_argument, NULL, OPT_SHM},
+	{"slack",   required_argument, NULL, 'T'},
+	{"tpns",    required_argument, NULL, OPT_TPNS},
+	{"trace",   required_argument, NULL, OPT_TRACE},
+	{"trigger", required_argument, NULL, OPT_TRIGGER},
 	{"width",   required_argument, NULL, 'w'},
+	{"work",    required_argument, NULL, OPT_WORK},
+	{NULL,                      0, NULL,  0 },
 };
 
 #ifdef	CPU_AFFINITY
-const char *OptString = "b:c:f:hk:m:o:p:r:sw:";
-const char *usage = "[-b bins] [-c cpu] [-f file] [-h] [-k knee] [-m min] [-o outbuf] [-p pause] [-r runtime] [-s] [-w width]";
+const char *OptString = "b:c:f:hHk:lm:o:p:P:r:sS:T:w:";
+const char *usage = "[-b bins] [-c cpu] [-f file] [-h] [-H] [-k knee] [-l] [-m min] [-o outbuf] [-p pause] [-P priority] [-r runtime] [-s] [-S sched] [-T slack] [-w width]";
 
 #else	/* CPU_AFFINITY */
-const char *OptString = "b:f:hk:m:o:p:r:sw:";
-const char *usage = "[-b bins] [-f file] [-h] [-k knee] [-m min] [-o outbuf] [-p pause] [-r runtime] [-s] [-w width]";
+const char *OptString = "b:f:hHk:lm:o:p:P:r:sS:T:w:";
+const char *usage = "[-b bins] [-f file] [-h] [-H] [-k knee] [-l] [-m min] [-o outbuf] [-p pause] [-P priority] [-r runtime] [-s] [-S sched] [-T slack] [-w width]";
 #endif	/* CPU_AFFINITY */
 
 /*! Note that Makefile parses the following line to extract version number */
 const char *version = "SLJ Test 1.0";
 
+/* The following two headers are assumed to have the same string length */
+/*! Histogram header when counting deltas */
+const char *cnt_graph_hdr = "Time    Ticks    Count        Percent    Cumulative  ";
+/*! Histogram header when summing deltas */
+const char *sum_graph_hdr = "Time    Ticks    Sum          Percent    Cumulative  ";
+/*! Stars for histogram graph bars */
+const char *graph_str = "*******************************************************************";
+
+/*! Command line as one string for the record */
+char cmdline[256];
+
 /*! Histogram table of timestamp deltas */
 bin_t *histo;
 
+/*! Histogram bin upper bounds padded to a multiple of 8 with sentinels for vector compares */
+uint64_t *histo_ub;
+/*! Number of entries in histo_ub */
+size_t histo_ub_len;
+
 /*! Ring BUFfer of recent OUTliers */
 outlier_t *outbuf = NULL;
+/*! Next open entry in outbuf */
+outlier_t *obp = NULL;
+/*! True when outbuf wrapped around */
+int didwrap = 0;
 /*! FILE where we write OUTliers */
 FILE *outfile = NULL;
 
+/*! Outliers merged into events */
+events_t events;
+
+/*! Rollup time series */
+rollup_t rollup;
+
+/*! Shapes of synthetic delta streams, as named in output and SLJTEST_TSC */
+const char *bench_shapes[] = {"bimodal", "heavy-tailed", "all-outlier"};
+
+#ifdef	TSC_REPLAY
+/*! Type for the state of the replayed timestamp source */
+typedef struct tsc_replay_stct {
+/*! Deltas replayed in order, over and over */
+	uint64_t *deltas;
+/*! Number of deltas */
+	uint64_t n;
+/*! Index of the next delta */
+	uint64_t i;
+/*! Replayed TSC value now */
+	uint64_t now;
+/*! Ticks per nanosecond of the replayed TSC */
+	double tpns;
+} tsc_replay_t;
+
+/*! Replayed timestamp source */
+tsc_replay_t tsc_replay;
+#endif	/* TSC_REPLAY */
+
 #ifdef	CPU_AFFINITY
+/*!
+ * \brief Parse a CPU list like "2" or "0,4-7" into a CPU set
+ * \param list CPU list as given on the command line
+ * \param set  CPU set to receive the CPUs
+ * \return 0 if list parsed, -1 otherwise.
+ */
+int
+cpulist_parse(const char *list, cpu_set_t *set) {
+	const char *p = list;
+	char *end;
+	long first, last;
+
+	CPU_ZERO(set);
+	do {
+		first = strtol(p, &end, 10);
+		if (end == p || first < 0)
+			return (-1);
+		last = first;
+		if (*end == '-') {
+			p = end+1;
+			last = strtol(p, &end, 10);
+			if (end == p || last < first)
+				return (-1);
+		}
+		if (last >= CPU_SETSIZE)
+			return (-1);
+		for (; first<=last; first++)
+			CPU_SET(first, set);
+		p = end+1;
+	} while (*end == ',');
+	return ((*end == '\0') ? 0 : -1);
+}
+
+/*!
+ * \brief Format a CPU set as a compact CPU list like "0,4-7"
+ * \param set CPU set to format
+ * \param buf Buffer to receive the list
+ * \param len Length of buf (bytes)
+ * \return buf
+ */
+char *
+cpulist_str(const cpu_set_t *set, char *buf, size_t len) {
+	int cpu, first;
+	size_t used = 0;
+
+	buf[0] = '\0';
+	for (cpu=0; cpu<CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, set))
+			continue;
+		for (first=cpu; cpu+1<CPU_SETSIZE && CPU_ISSET(cpu+1, set); cpu++) {}
+		if (used < len) {
+			if (first == cpu)
+				used += snprintf(buf+used, len-used, "%s%d",
+				    used ? "," : "", cpu);
+			else
+				used += snprintf(buf+used, len-used, "%s%d-%d",
+				    used ? "," : "", first, cpu);
+		}
+	}
+	return (buf);
+}
+
 /*!
  * \brief Set CPU affinity
  * \param affinity CPUs for affinity expressed as a character string
+ *
+ * Reports the affinity actually in effect afterwards.
  */
-static void
+void
 set_affinity(const char* affinity) {
-        struct bitmask *bm;
+	cpu_set_t set;
+	char buf[256];
 
-        fprintf(stderr, "Requesting CPU affinity on core %s\n", affinity);
-	if ((bm=bitmask_alloc(__CPU_SETSIZE)) == NULL) {
-		fprintf(stderr, "bitmask_alloc failed\n");
+	if (cpulist_parse(affinity, &set) != 0) {
+		fprintf(stderr, "Unable to parse CPU list %s\n", affinity);
 		exit(1);
 	}
-	if (bitmask_parselist(affinity, bm) != 0) {
-		fprintf(stderr, "bitmask_parselist failed\n");
-		exit(1);
+	if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+		printf("CPU affinity            : failed to set %s, %s\n",
+		    affinity, strerror(errno));
+	}
+	if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+		printf("CPU affinity            : %s\n",
+		    cpulist_str(&set, buf, sizeof(buf)));
+	}
+}
+#endif	/* CPU_AFFINITY */
+
+/*!
+ * \brief Apply requested scheduling policy, priority, and timer slack
+ *
+ * Settings are read back after being applied so the report shows what
+ * the timing thread actually ran with, not just what was asked for.
+ */
+void
+sched_setup() {
+#ifdef	__linux__
+	struct sched_param sp;
+	int policy;
+
+	if (args.sched != NULL) {
+		if (strcmp(args.sched, "fifo") == 0) {
+			policy = SCHED_FIFO;
+		} else if (strcmp(args.sched, "rr") == 0) {
+			policy = SCHED_RR;
+		} else {
+			policy = SCHED_OTHER;
+		}
+		memset(&sp, 0, sizeof(sp));
+		sp.sched_priority = (policy == SCHED_OTHER) ? 0 : args.prio;
+		if (sched_setscheduler(0, policy, &sp) != 0) {
+			printf("Scheduling policy       : failed to set %s priority %d, %s%s\n",
+			    args.sched, sp.sched_priority, strerror(errno),
+			    (errno == EPERM) ?
+			    " (need CAP_SYS_NICE or higher ulimit -r)" : "");
+		}
 	}
-        if (sched_setaffinity(0, bitmask_nbytes(bm),
-	    (cpu_set_t *)bitmask_mask(bm)) < 0) {
-                fprintf(stderr, "%s: failed to set affinity to %s\n", affinity);
+	if (args.slack >= 0) {
+		if (prctl(PR_SET_TIMERSLACK, (unsigned long)args.slack, 0, 0, 0) != 0) {
+			printf("Timer slack             : failed to set %ldns, %s\n",
+			    args.slack, strerror(errno));
+		}
 	}
+
+	/* Report what's in effect, whether we set it or a wrapper did */
+	policy = sched_getscheduler(0);
+	sched_getparam(0, &sp);
+	printf("Scheduling policy       : %s priority %d\n",
+	    (policy == SCHED_FIFO) ? "SCHED_FIFO" :
+	    (policy == SCHED_RR  ) ? "SCHED_RR"   : "SCHED_OTHER",
+	    sp.sched_priority);
+	printf("Timer slack             : %dns\n", prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0));
+#else	/* __linux__ */
+	printf("Scheduling policy       : not supported on this platform\n");
+#endif	/* __linux__ */
 }
+
+/*!
+ * \brief Move a helper thread out of the way of the timing thread
+ *
+ * Helper threads inherit the affinity and scheduling policy of the timing
+ * thread.  They drop back to SCHED_OTHER and move to every CPU not being
+ * measured, if there are any, so their work never lands on a measured CPU.
+ */
+void
+helper_setup() {
+#ifdef	CPU_AFFINITY
+	struct sched_param sp;
+	cpu_set_t measured, set;
+	int cpu;
+
+	memset(&sp, 0, sizeof(sp));
+	sched_setscheduler(0, SCHED_OTHER, &sp);
+	if (sched_getaffinity(0, sizeof(measured), &measured) != 0)
+		return;
+	CPU_ZERO(&set);
+	for (cpu=0; cpu<CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, &measured))
+			CPU_SET(cpu, &set);
+	}
+	/* Fails harmlessly when no affinity was set and every CPU is measured */
+	sched_setaffinity(0, sizeof(set), &set);
 #endif	/* CPU_AFFINITY */
+}
 
 #ifndef HAVE_ASPRINTF
 /*! \brief sprintf() to a malloc()'d string
@@ -293,16 +1143,20 @@ set_affinity(const char* affinity) {
  * I'm looking at you Solaris.
  */
 int
-#define	RET_MAX_LEN 10	/* Maximum length of return string */
 asprintf(char **ret, const char *format, ...) {
 	va_list ap;
+	int len;
 
+	/* Measure first so the string is never truncated */
 	va_start(ap, format);
-	if ((*ret=malloc(RET_MAX_LEN)) == NULL) {
+	len = vsnprintf(NULL, 0, format, ap);
+	va_end(ap);
+	if (len < 0 || (*ret=malloc(len+1)) == NULL) {
 		fprintf(stderr, "asprintf: malloc() failed\n");
 		return(-1);
 	}
-	vsnprintf(*ret, RET_MAX_LEN, format, ap);
+	va_start(ap, format);
+	vsnprintf(*ret, len+1, format, ap);
 	va_end(ap);
 	return(0);
 }
@@ -330,6 +1184,35 @@ t2ts(uint64_t ticks, double tpns) {
 	return (s);
 }
 
+/*!
+ * \brief Measure TSC ticks per nanosecond against the time of day clock
+ * \param ms Milliseconds to measure over
+ * \return Ticks per nanosecond
+ */
+double
+tsc_calibrate(int ms) {
+	struct timeval tv;
+	uint64_t start_tsc, stop_tsc, start_us, now_us;
+
+	gettimeofday(&tv, NULL);
+	start_us = tv.tv_sec * 1000000UL + tv.tv_usec;
+	rdtsc(start_tsc);
+	do {
+		gettimeofday(&tv, NULL);
+		now_us = tv.tv_sec * 1000000UL + tv.tv_usec;
+	} while (now_us < start_us + 1000UL*ms);
+	rdtsc(stop_tsc);
+	return ((stop_tsc-start_tsc)/1000.0/(now_us-start_us));
+}
+
+/*! \brief qsort() comparison for ascending doubles */
+int
+dbl_cmp(const void *a, const void *b) {
+	double da = *(const double *)a, db = *(const double *)b;
+
+	return ((da > db) - (da < db));
+}
+
 /*
  * \brief  Parse command line arguments.
  * \param  argc Count of arguments as passed to main().
@@ -357,18 +1240,136 @@ args_parse(int argc, char *argv[]) {
 			args.outfile = strdup(optarg);
 			break;
 
+		case 'H':
+			args.huge++;
+			break;
+
+		case OPT_KERNEL:
+			args.kernel  = strdup(optarg);
+			break;
+
+		case OPT_LOAD:
+			args.load    = strdup(optarg);
+			break;
+
+		case OPT_AGGREGATE:
+			args.aggregate = strdup(optarg);
+			break;
+
+		case OPT_REPLAY:
+			args.replay  = strdup(optarg);
+			break;
+
+		case OPT_TPNS:
+			args.tpns    = atof(optarg);
+			break;
+
+		case OPT_SAVE:
+			args.save    = strdup(optarg);
+			break;
+
+		case OPT_TRACE:
+			args.trace   = strdup(optarg);
+			break;
+
+		case OPT_DUMP_TRACE:
+			args.dump_trace = strdup(optarg);
+			break;
+
+		case OPT_GAP:
+			args.gap     = atoi(optarg);
+			break;
+
+		case OPT_EVENTS:
+			args.events  = strdup(optarg);
+			break;
+
+		case OPT_TRIGGER:
+			args.trigger = strtoull(optarg, NULL, 10);
+			break;
+
+		case OPT_CONTEXT:
+			args.context = strtoull(optarg, NULL, 10);
+			break;
+
+		case OPT_RECORD:
+			args.record  = strdup(optarg);
+			break;
+
+		case OPT_LIVE:
+			args.live++;
+			break;
+
+		case OPT_SERIES:
+			args.series  = strdup(optarg);
+			break;
+
+		case OPT_BENCH:
+			args.bench++;
+			break;
+
+		case OPT_FREQ:
+			args.freq    = strdup(optarg);
+			break;
+
+		case OPT_CSTATES:
+			args.cstates = strdup(optarg);
+			break;
+
+		case OPT_SCAN:
+			args.scan++;
+			break;
+
+		case OPT_AUDIT:
+			args.audit++;
+			break;
+
+		case OPT_WORK:
+			args.work    = strdup(optarg);
+			break;
+
+		case OPT_SHM:
+			args.shm     = strdup(optarg);
+			break;
+
+		case OPT_PEEK:
+			args.peek    = strdup(optarg);
+			break;
+
+		case OPT_INTERVAL:
+			args.interval = atof(optarg);
+			break;
+
+		case OPT_CORRECT:
+			args.correct++;
+			break;
+
 		case 'k':
 			args.knee    = atoi(optarg);
 			break;
 
+		case 'l':
+			args.lock++;
+			break;
+
 		case 'm':
 			args.min     = atoi(optarg);
 			break;
 
+		case 'o':
+			args.outbuf  = atoi(optarg);
+			break;
+
 		case 'p':
 			args.pause   = atoi(optarg);
 			break;
 
+		case 'P':
+			args.prio    = atoi(optarg);
+			if (args.sched == NULL)
+				args.sched = "fifo";
+			break;
+
 		case 'r':
 			args.runtime = atoi(optarg);
 			break;
@@ -377,69 +1378,5390 @@ args_parse(int argc, char *argv[]) {
 			args.sum++;
 			break;
 
+		case 'S':
+			args.sched   = strdup(optarg);
+			break;
+
+		case 'T':
+			args.slack   = atol(optarg);
+			break;
+
 		case 'w':
 			args.linewid = atoi(optarg);
 			break;
 
-		case 'h':
-		default:
-			return (1);
+		case 'h':
+		default:
+			return (1);
+		}
+	}
+	return (0);
+}
+
+/*!
+ * \brief Lock all current and future memory so no page can be swapped out during timing
+ *
+ * Reports the result since failure is common without CAP_IPC_LOCK or a
+ * generous RLIMIT_MEMLOCK.
+ */
+void
+mem_lock() {
+#ifndef _WIN32
+	if (mlockall(MCL_CURRENT|MCL_FUTURE) == 0) {
+		printf("Memory lock (mlockall)  : ok\n");
+	} else {
+		printf("Memory lock (mlockall)  : failed, %s%s\n", strerror(errno),
+		    (errno==EPERM || errno==ENOMEM) ?
+		    " (need CAP_IPC_LOCK or higher ulimit -l)" : "");
+	}
+#else	/* _WIN32 */
+	printf("Memory lock (mlockall)  : not supported on this platform\n");
+#endif	/* _WIN32 */
+}
+
+/*!
+ * \brief Allocate a zeroed buffer that will be touched while timing
+ * \param size Size of buffer (bytes)
+ * \param what Name of buffer for the setup report
+ * \return Pointer to buffer, or NULL if allocation failed
+ *
+ * Every page of the buffer is written here so that first-touch page faults
+ * are taken during setup instead of showing up as outliers.
+ * With \c -H, explicit huge pages are tried first, then transparent huge
+ * pages are requested for regular pages.
+ * The backing actually obtained is reported when \c -l or \c -H is given.
+ */
+void *
+buf_alloc(size_t size, const char *what) {
+	void *buf = NULL;
+	const char *backing = "regular pages";
+	char hugemsg[99] = "";
+
+#ifdef	MAP_HUGETLB
+	if (args.huge) {
+		/* Explicit huge page mappings must be a multiple of the huge page size */
+		size_t hsize = (size+HUGE_PAGE_SIZE-1) & ~((size_t)HUGE_PAGE_SIZE-1);
+
+		buf = mmap(NULL, hsize, PROT_READ|PROT_WRITE,
+		    MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+		if (buf == MAP_FAILED) {
+			snprintf(hugemsg, sizeof(hugemsg), ", MAP_HUGETLB failed (%s)",
+			    strerror(errno));
+			buf = NULL;
+		} else {
+			backing = "explicit huge pages (MAP_HUGETLB)";
+		}
+	}
+#endif	/* MAP_HUGETLB */
+
+	if (buf == NULL) {
+#ifndef _WIN32
+		buf = mmap(NULL, size, PROT_READ|PROT_WRITE,
+		    MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if (buf == MAP_FAILED)
+			return (NULL);
+#ifdef	MADV_HUGEPAGE
+		if (args.huge) {
+			if (madvise(buf, size, MADV_HUGEPAGE) == 0) {
+				backing = "transparent huge pages advised";
+			} else {
+				snprintf(hugemsg+strlen(hugemsg),
+				    sizeof(hugemsg)-strlen(hugemsg),
+				    ", MADV_HUGEPAGE failed (%s)", strerror(errno));
+			}
+		}
+#endif	/* MADV_HUGEPAGE */
+#else	/* _WIN32 */
+		if ((buf=calloc(1, size)) == NULL)
+			return (NULL);
+#endif	/* _WIN32 */
+	}
+
+	/* Prefault by writing every page */
+	memset(buf, 0, size);
+
+	if (args.lock || args.huge) {
+		printf("%-24s: %zu bytes prefaulted, %s%s\n",
+		    what, size, backing, hugemsg);
+	}
+	return (buf);
+}
+
+/*! \brief Allocate memory and open file for outliers logging
+ */
+void
+outliers_setup() {
+	if ((outbuf=(outlier_t *)buf_alloc(args.outbuf*sizeof(outlier_t),
+	    "Outlier buffer")) == NULL) {
+		fprintf(stderr, "Couldn't allocate memory for outlier buffer\n");
+		exit(1);
+	}
+	obp = outbuf;
+	if ((outfile=fopen(args.outfile, "w")) == NULL) {
+		fprintf(stderr, "Unable to create outliers file %s\n",
+		    args.outfile);
+		perror(args.outfile);
+		exit(1);
+	}
+}
+
+/*!
+ * \brief Allocate the histogram and its padded bin bounds and fill in the bounds
+ * \return 0 if set up, -1 if out of memory
+ *
+ * Doesn't exit on failure so the library can return an error instead.
+ */
+int
+histo_setup() {
+	bin_t *bp;
+
+	/* Allocate memory for histogram */
+	if ((histo=(bin_t *)buf_alloc(sizeof(bin_t)*args.bins,
+	    "Histogram buffer")) == NULL)
+		return (-1);
+
+	/*
+	 * Fill first half of histogram table with values up to knee.
+	 * Evenly divide upper bound values through knee among bins.
+	 */
+	for (bp=histo; bp<histo+(args.bins/2); bp++) {
+		bp->ub = args.min+(args.knee-args.min)*(bp-histo+1)/(args.bins/2);
+		bp->delta_count = 0;
+		bp->delta_sum   = 0;
+	}
+	/* Fill second half of histogram table with values above knee */
+	/* Advance each bin upper bound by 1/2 an order of magnitude */
+	uint64_t mult = args.knee;
+	for (        ; bp<histo+args.bins; bp++) {
+		bp->ub = mult*2;
+		bp->delta_count = 0;
+		bp->delta_sum   = 0;
+		bp++;
+
+		mult *= 10;
+		bp->ub = mult;
+		bp->delta_count = 0;
+		bp->delta_sum   = 0;
+	}
+	histo[args.bins-1].ub = UINT64_MAX;	/* Sentinel */
+
+	/* Copy upper bounds into a padded array so vector kernels need no tail handling */
+	histo_ub_len = (args.bins+7) & ~(size_t)7;
+	if ((histo_ub=(uint64_t *)buf_alloc(sizeof(uint64_t)*histo_ub_len,
+	    "Bin bounds buffer")) == NULL)
+		return (-1);
+	for (size_t i=0; i<histo_ub_len; i++)
+		histo_ub[i] = (i < args.bins) ? histo[i].ub : UINT64_MAX;
+	return (0);
+}
+
+/*!
+ * \brief Set up event size histogram and, if writing events, the event buffer
+ *
+ * Event size bins share the upper bounds of histogram bins above the knee,
+ * since every outlier, and so every event, is bigger than the knee.
+ */
+void
+events_setup() {
+	uint64_t i;
+
+	events.bins = args.bins-args.bins/2;
+	if ((events.histo=(ebin_t *)buf_alloc(sizeof(ebin_t)*events.bins,
+	    "Event histogram buffer")) == NULL) {
+		fprintf(stderr, "Couldn't allocate memory for event histogram\n");
+		exit(1);
+	}
+	for (i=0; i<events.bins; i++)
+		events.histo[i].ub = histo[args.bins/2+i].ub;
+
+	if (args.events != NULL && args.outbuf != 0) {
+		if ((events.buf=(event_t *)buf_alloc(args.outbuf*sizeof(event_t),
+		    "Event buffer")) == NULL) {
+			fprintf(stderr, "Couldn't allocate memory for event buffer\n");
+			exit(1);
+		}
+		events.next = events.buf;
+	}
+}
+
+/*! \brief Count the event being merged and save it if writing events */
+void
+event_close() {
+	ebin_t *ebp;
+
+	/* Note: no end test is needed because of infinite sentinel */
+	for (ebp=events.histo; events.cur.sum>ebp->ub; ebp++) {}
+	ebp->events++;
+	ebp->deltas += events.cur.count;
+	ebp->sum    += events.cur.sum;
+
+	if (events.buf != NULL) {
+		*events.next++ = events.cur;
+		if (events.next-events.buf >= args.outbuf) {
+			events.next = events.buf;
+			events.didwrap = 1;
+		}
+	}
+	events.cur.count = 0;
+}
+
+/*!
+ * \brief Merge an outlier into the current event, or start a new one
+ * \param when  TSC at the start of the outlier
+ * \param delta Size of outlier (ticks)
+ */
+static inline void
+event_add(uint64_t when, uint64_t delta) {
+	if (events.cur.count != 0 &&
+	    (int64_t)(when-events.cur.end) <= (int64_t)args.gap) {
+		events.cur.end = when+delta;
+		events.cur.count++;
+		events.cur.sum += delta;
+		return;
+	}
+	if (events.cur.count != 0)
+		event_close();
+	events.cur.start = when;
+	events.cur.end   = when+delta;
+	events.cur.count = 1;
+	events.cur.sum   = delta;
+}
+
+/*!
+ * \brief Print interruption rate, time lost, and event size histogram
+ * \param rp Results of the run, for the minimum delta and runtime
+ */
+void
+events_print(const results_t *rp) {
+	const ebin_t *ebp;
+	uint64_t n = 0, deltas = 0, sum = 0, stolen, c_events = 0;
+
+	for (ebp=events.histo; ebp<events.histo+events.bins; ebp++) {
+		n      += ebp->events;
+		deltas += ebp->deltas;
+		sum    += ebp->sum;
+	}
+	stolen = sum - deltas*rp->stats.min;
+
+	printf("\nInterruptions           : %" PRIu64 " events from %" PRIu64
+	    " outliers within %" PRIu64 " ticks, %.1f per second\n",
+	    n, deltas, args.gap, n/(rp->run_us/1E6));
+	if (n == 0)
+		return;
+	printf("Time lost               : %s, %.4f%% of runtime, %s per event\n",
+	    t2ts(stolen, rp->tpns), 100.0*stolen/rp->run_ticks,
+	    t2ts(stolen/n, rp->tpns));
+
+	printf("Event   Ticks    Events       Percent    Cumulative   Lost\n");
+	for (ebp=events.histo; ebp<events.histo+events.bins; ebp++) {
+		char *ub_str, ubbuf[99];
+
+		c_events += ebp->events;
+		if (ebp->ub == UINT64_MAX)
+			ub_str = "Infinite";
+		else {
+			sprintf(ubbuf, "%-8" PRIu64, ebp->ub);
+			ub_str = ubbuf;
+		}
+		printf("%s  %s %-12" PRIu64 " %7.4f%%  %8.4f%%    %s\n",
+		    t2ts(ebp->ub, rp->tpns), ub_str, ebp->events,
+		    100.0*ebp->events/n, 100.0*c_events/n,
+		    t2ts(ebp->sum-ebp->deltas*rp->stats.min, rp->tpns));
+	}
+}
+
+/*!
+ * \brief Write buffered events to the events file
+ * \param rp        Results of the run, for the minimum delta and tpns
+ * \param start_tsc TSC at the start of the run
+ *
+ * Each line is start time in ms relative to the start of the test,
+ * duration in us, number of outlying deltas, and time lost in us.
+ */
+void
+events_write(const results_t *rp, uint64_t start_tsc) {
+	event_t *ep = events.didwrap ? events.next : events.buf;
+	size_t i, n = events.didwrap ? (size_t)args.outbuf : (size_t)(events.next-events.buf);
+	FILE *fp;
+
+	if ((fp=fopen(args.events, "w")) == NULL) {
+		fprintf(stderr, "Unable to create events file %s\n", args.events);
+		perror(args.events);
+		return;
+	}
+	/* Oldest first, starting after the newest if the buffer wrapped */
+	for (i=0; i<n; i++) {
+		fprintf(fp, "%f, %f, %" PRIu64 ", %f\n",
+		    (ep->start-start_tsc)/rp->tpns/1000000.0,
+		    (ep->end-ep->start)/rp->tpns/1000.0, ep->count,
+		    (ep->sum-ep->count*rp->stats.min)/rp->tpns/1000.0);
+		if (++ep >= events.buf+args.outbuf)
+			ep = events.buf;
+	}
+	fclose(fp);
+	if (events.didwrap)
+		printf("Events buffer wrapped, only the last %d events were written\n",
+		    args.outbuf);
+}
+
+/*!
+ * \brief Analysis kernel for one block of deltas
+ * \param deltas BLOCK_DELTAS deltas from one block of timestamps
+ * \param sp     Running statistics, updated in place
+ * \return Bit mask with bit i set if deltas[i] is above the knee
+ *
+ * Each kernel counts and sums deltas into their histogram bins.
+ */
+typedef uint32_t (*block_fn_t)(const uint64_t *deltas, stats_t *sp);
+
+/*!
+ * \brief Add a block's count, sum, and sum of squares to running statistics
+ * \param deltas BLOCK_DELTAS deltas from one block of timestamps
+ * \param sp     Running statistics, updated in place
+ * \param sum    Sum of the block's deltas
+ * \param sumsq  Sum of the block's squared deltas if bmax < 2^30, else ignored
+ * \param bmax   Maximum delta in the block
+ *
+ * Squares of deltas below 2^30 can't overflow 64 bits even summed over a
+ * block, so the wide sum is only needed for blocks with huge deltas.
+ */
+static inline void
+stats_add_block(const uint64_t *deltas, stats_t *sp, uint64_t sum,
+    uint64_t sumsq, uint64_t bmax) {
+	sp->count += BLOCK_DELTAS;
+	sp->sum   += sum;
+	if (bmax < (1ULL<<30)) {
+		sp->sumsq += sumsq;
+	} else {
+		for (int i=0; i<BLOCK_DELTAS; i++)
+			sp->sumsq += (sumsq_t)deltas[i]*deltas[i];
+	}
+}
+
+/*!
+ * \brief Population standard deviation of deltas
+ * \param sp Statistics
+ * \return Standard deviation (ticks)
+ *
+ * Computed as sqrt((sumsq - sum^2/n) / n), with the integer part of
+ * sum^2/n subtracted exactly and only the remainder in floating point.
+ */
+double
+stats_std_dev(const stats_t *sp) {
+	sumsq_t sq, m2;
+
+	if (sp->count == 0)
+		return (0.0);
+	sq = (sumsq_t)sp->sum*sp->sum;
+#ifdef	__SIZEOF_INT128__
+	m2 = sp->sumsq - sq/sp->count;
+	return (sqrt(((long double)m2 - (long double)(sq%sp->count)/sp->count)/sp->count));
+#else	/* __SIZEOF_INT128__ */
+	m2 = sp->sumsq - sq/sp->count;
+	return (sqrt(m2/sp->count));
+#endif	/* __SIZEOF_INT128__ */
+}
+
+/*!
+ * \brief Merge statistics from another run or thread
+ * \param dst Statistics to merge into
+ * \param src Statistics to merge from
+ */
+void
+stats_merge(stats_t *dst, const stats_t *src) {
+	if (src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	dst->count += src->count;
+	dst->sum   += src->sum;
+	dst->sumsq += src->sumsq;
+}
+
+/*!
+ * \brief Add one delta to a histogram and its statistics outside the analysis kernel
+ * \param hp    Histogram table with the usual infinite sentinel
+ * \param sp    Statistics to update
+ * \param delta Delta to add (ticks)
+ */
+void
+histo_add(bin_t *hp, stats_t *sp, uint64_t delta) {
+	bin_t *bp;
+
+	/* Note: no end test is needed because of infinite sentinel */
+	for (bp=hp; delta>bp->ub; bp++) {}
+	bp->delta_count++;
+	bp->delta_sum += delta;
+	if (delta < sp->min)
+		sp->min = delta;
+	if (delta > sp->max)
+		sp->max = delta;
+	sp->count++;
+	sp->sum += delta;
+	sp->sumsq += (sumsq_t)delta*delta;
+}
+
+/*!
+ * \brief Add the deltas lo, lo+step, ... lo+(n-1)*step to a histogram and its statistics
+ * \param hp   Histogram table with the usual infinite sentinel
+ * \param sp   Statistics to update
+ * \param lo   Smallest delta to add (ticks)
+ * \param step Difference between successive deltas (ticks), > 0
+ * \param n    Number of deltas to add
+ *
+ * Each bin gets its count and sum in closed form, so the cost doesn't
+ * grow with n.
+ */
+void
+histo_add_seq(bin_t *hp, stats_t *sp, uint64_t lo, uint64_t step, uint64_t n) {
+	bin_t *bp;
+	uint64_t j, jhi, cnt;
+
+	if (n == 0)
+		return;
+	/* Deltas j to jhi-1 fall in each bin; the sum of j's is exact with the even factor halved */
+	for (bp=hp, j=0; j<n; bp++) {
+		if (bp->ub < lo)
+			continue;
+		jhi = (bp->ub-lo)/step+1;
+		if (jhi > n)
+			jhi = n;
+		if (jhi <= j)
+			continue;
+		cnt = jhi-j;
+		bp->delta_count += cnt;
+		bp->delta_sum += cnt*lo + step*((cnt%2 == 0) ? cnt/2*(j+jhi-1) : cnt*((j+jhi-1)/2));
+		j = jhi;
+	}
+	if (lo < sp->min)
+		sp->min = lo;
+	if (lo+(n-1)*step > sp->max)
+		sp->max = lo+(n-1)*step;
+	sp->count += n;
+	sp->sum += n*lo + step*((n%2 == 0) ? n/2*(n-1) : n*((n-1)/2));
+	sp->sumsq += (sumsq_t)n*lo*lo + (sumsq_t)lo*step*n*(n-1) +
+	    (sumsq_t)step*step*((sumsq_t)(n-1)*n*(2*n-1)/6);
+}
+
+/*!
+ * \brief Estimate a percentile from the histogram
+ * \param rp  Results holding the histogram
+ * \param pct Percentile wanted (0-100)
+ * \return Upper bound of the bin holding the percentile, but no more than the maximum (ticks)
+ */
+uint64_t
+histo_percentile(const results_t *rp, double pct) {
+	const bin_t *bp;
+	uint64_t c_count = 0;
+	double want = rp->stats.count*pct/100.0;
+
+	for (bp=rp->histo; bp<rp->histo+rp->bins-1; bp++) {
+		c_count += bp->delta_count;
+		if (c_count >= want)
+			break;
+	}
+	return ((bp->ub < rp->stats.max) ? bp->ub : rp->stats.max);
+}
+
+/*!
+ * \brief Compute time stolen from the timing loop
+ * \param rp Results holding the histogram
+ * \return Ticks taken by deltas above the knee in excess of the minimum delta
+ */
+uint64_t
+histo_stolen(const results_t *rp) {
+	const bin_t *bp;
+	uint64_t stolen = 0;
+
+	for (bp=rp->histo+rp->bins/2; bp<rp->histo+rp->bins; bp++)
+		stolen += bp->delta_sum - bp->delta_count*rp->stats.min;
+	return (stolen);
+}
+
+/*!
+ * \brief Close the current window of a rollup level and start the next
+ * \param lv      Level to close
+ * \param end     TSC at the end of the window
+ * \param cascade True to close the next level too when its window is full
+ *
+ * Window statistics come from the change in the histogram since the
+ * window started, so no per-delta work is needed.
+ */
+void
+roll_close(int lv, uint64_t end, int cascade) {
+	level_t *lp = &rollup.level[lv];
+	window_t *wp = &lp->ring[lp->n % lp->len];
+	bin_t *dp = rollup.diff;
+	results_t d;
+	uint64_t i, bound = 0, outliers = 0;
+
+	memset(&d, 0, sizeof(d));
+	d.histo = dp;
+	d.bins = args.bins;
+	d.stats.min = rollup.stats->min;
+	for (i=0; i<args.bins; i++) {
+		dp[i].ub = histo[i].ub;
+		dp[i].delta_count = histo[i].delta_count-lp->base[i].delta_count;
+		dp[i].delta_sum   = histo[i].delta_sum  -lp->base[i].delta_sum;
+		lp->base[i] = histo[i];
+		d.stats.count += dp[i].delta_count;
+		if (i >= args.bins/2)
+			outliers += dp[i].delta_count;
+		if (dp[i].delta_count != 0)
+			bound = dp[i].ub;
+	}
+	/* Outliers give the exact max, else the top of the highest bin used bounds it */
+	d.stats.max = (lp->max != 0) ? lp->max : bound;
+
+	wp->start    = lp->start;
+	wp->end      = end;
+	wp->max      = d.stats.max;
+	wp->p999     = (d.stats.count != 0) ? histo_percentile(&d, 99.9) : 0;
+	wp->outliers = outliers;
+	wp->stolen   = (d.stats.count != 0) ? histo_stolen(&d) : 0;
+	if (wp->max > lp->worst.max)
+		lp->worst = *wp;
+
+	/* Release so helper threads that see the count see the window */
+	__atomic_store_n(&lp->n, lp->n+1, __ATOMIC_RELEASE);
+	lp->start = end;
+	if (lv+1 < (int)ARRAY_SIZE(rollup.level)) {
+		level_t *up = lp+1;
+
+		if (lp->max > up->max)
+			up->max = lp->max;
+		if (cascade && lp->n%up->per == 0)
+			roll_close(lv+1, end, cascade);
+	}
+	lp->max = 0;
+}
+
+/*!
+ * \brief Print one rollup window
+ * \param what      Which window, like "Worst"
+ * \param name      Name of window length, like "1ms"
+ * \param wp        Window to print
+ * \param start_tsc TSC at the start of the run
+ * \param tpns      Ticks per nanosecond
+ */
+void
+roll_print(const char *what, const char *name, const window_t *wp,
+    uint64_t start_tsc, double tpns) {
+	char label[99];
+
+	snprintf(label, sizeof(label), "%s %s window", what, name);
+	printf("%-24s: at %.3fms, max %s, 99.9%% %s, %" PRIu64 " outliers, stolen %s\n",
+	    label, (wp->start-start_tsc)/tpns/1E6, t2ts(wp->max, tpns),
+	    t2ts(wp->p999, tpns), wp->outliers, t2ts(wp->stolen, tpns));
+}
+
+/*!
+ * \brief Close finest windows up to now
+ * \param now TSC at the end of the block just taken
+ *
+ * Called between blocks when a window deadline has passed.
+ * Windows that passed entirely during a stall are closed empty.
+ */
+void
+roll_tick(uint64_t now) {
+	do {
+		roll_close(0, rollup.deadline, 1);
+		rollup.deadline += rollup.ticks;
+	} while (now >= rollup.deadline);
+}
+
+/*!
+ * \brief Allocate rollup rings and size the finest window
+ * \param sp   Statistics the timing thread will update
+ * \param tpns Ticks per nanosecond calibrated before the run
+ */
+void
+roll_setup(const stats_t *sp, double tpns) {
+	/* Name, windows of the level below per window, and ring length */
+	static const struct {
+		const char *name;
+		uint64_t per, len;
+	} def[] = {
+		{"1ms",  1,    ROLL_MS_WINDOWS },
+		{"1s",   1000, ROLL_S_WINDOWS  },
+		{"1min", 60,   ROLL_MIN_WINDOWS},
+	};
+	size_t lv;
+
+	rollup.stats = sp;
+	rollup.tpns = tpns;
+	rollup.ticks = (uint64_t)(rollup.tpns*1E6);
+	if ((rollup.diff=(bin_t *)buf_alloc(sizeof(bin_t)*args.bins,
+	    "Rollup buffer")) == NULL) {
+		fprintf(stderr, "Couldn't allocate memory for rollups\n");
+		exit(1);
+	}
+	for (lv=0; lv<ARRAY_SIZE(rollup.level); lv++) {
+		level_t *lp = &rollup.level[lv];
+
+		lp->name = def[lv].name;
+		lp->per  = def[lv].per;
+		lp->len  = def[lv].len;
+		lp->ring = (window_t *)buf_alloc(sizeof(window_t)*lp->len, "Rollup ring");
+		lp->base = (bin_t *)buf_alloc(sizeof(bin_t)*args.bins, "Rollup base buffer");
+		if (lp->ring==NULL || lp->base==NULL) {
+			fprintf(stderr, "Couldn't allocate memory for rollups\n");
+			exit(1);
+		}
+	}
+}
+
+/*!
+ * \brief Start the first window of every level
+ * \param start_tsc TSC at the start of the run
+ */
+void
+roll_start(uint64_t start_tsc) {
+	size_t lv;
+
+	for (lv=0; lv<ARRAY_SIZE(rollup.level); lv++)
+		rollup.level[lv].start = start_tsc;
+	rollup.start = start_tsc;
+	rollup.deadline = start_tsc+rollup.ticks;
+}
+
+/*!
+ * \brief Close partial windows at the end of the run and report on them
+ * \param end       TSC at the end of the run
+ * \param start_tsc TSC at the start of the run
+ * \param tpns      Ticks per nanosecond measured over the run
+ */
+void
+roll_finish(uint64_t end, uint64_t start_tsc, double tpns) {
+	const window_t *wp;
+	uint64_t i, n;
+	size_t lv;
+	FILE *fp;
+
+	for (lv=0; lv<ARRAY_SIZE(rollup.level); lv++) {
+		if (rollup.level[lv].start < end)
+			roll_close(lv, end, 0);
+	}
+
+	for (lv=0; lv<ARRAY_SIZE(rollup.level); lv++)
+		roll_print("Worst", rollup.level[lv].name, &rollup.level[lv].worst, start_tsc, tpns);
+
+	if ((fp=fopen(args.series, "w")) == NULL) {
+		fprintf(stderr, "Unable to create time series file %s\n", args.series);
+		perror(args.series);
+		return;
+	}
+	fprintf(fp, "# window, start ms, length ms, max us, 99.9%% us, outliers, stolen us\n");
+	for (lv=0; lv<ARRAY_SIZE(rollup.level); lv++) {
+		const level_t *lp = &rollup.level[lv];
+
+		/* Oldest first */
+		n = (lp->n < lp->len) ? lp->n : lp->len;
+		for (i=lp->n-n; i<lp->n; i++) {
+			wp = &lp->ring[i % lp->len];
+			fprintf(fp, "%s, %f, %f, %f, %f, %" PRIu64 ", %f\n", lp->name,
+			    (wp->start-start_tsc)/tpns/1E6, (wp->end-wp->start)/tpns/1E6,
+			    wp->max/tpns/1E3, wp->p999/tpns/1E3, wp->outliers,
+			    wp->stolen/tpns/1E3);
+		}
+	}
+	fclose(fp);
+	printf("Time series             : %s\n", args.series);
+}
+
+/*! \brief Portable analysis kernel, one delta at a time (see block_fn_t) */
+uint32_t
+block_scalar(const uint64_t *deltas, stats_t *sp) {
+	const uint64_t *dp;
+	bin_t *bp;
+	uint64_t bmin = UINT64_MAX, bmax = 0, sum = 0, sumsq = 0;
+	uint32_t mask = 0;
+
+	for (dp=deltas; dp<deltas+BLOCK_DELTAS; dp++) {
+		if (*dp < bmin)
+			bmin  = *dp;
+		if (*dp > bmax)
+			bmax  = *dp;
+		sum   += *dp;
+		sumsq += *dp * *dp;
+
+		/* Find bin to count this delta */
+		/* Note: no end test is needed because of infinite sentinel */
+		for (bp=histo; *dp>bp->ub; bp++) {}
+
+		bp->delta_count++;
+		bp->delta_sum += *dp;
+
+		if (*dp > args.knee)
+			mask |= 1u << (dp-deltas);
+	}
+	if (bmin < sp->min)
+		sp->min = bmin;
+	if (bmax > sp->max)
+		sp->max = bmax;
+	stats_add_block(deltas, sp, sum, sumsq, bmax);
+	return (mask);
+}
+
+#ifdef	SIMD_KERNELS
+/*!
+ * \brief AVX2 analysis kernel (see block_fn_t)
+ *
+ * AVX2 only has signed 64-bit compares, so values are biased by 2^63
+ * to compare them as unsigned.
+ * A delta's bin index is the number of bin upper bounds it exceeds.
+ */
+__attribute__((target("avx2")))
+uint32_t
+block_avx2(const uint64_t *deltas, stats_t *sp) {
+	const __m256i bias = _mm256_set1_epi64x((long long)0x8000000000000000ULL);
+	const __m256i knee = _mm256_xor_si256(_mm256_set1_epi64x((long long)args.knee), bias);
+	const __m256i tailmask = _mm256_set_epi64x(0, 0, -1, -1);
+	__m256i v[3], lo, hi, gt, sum, sumsq;
+	uint64_t lanes[4], bmin, bmax;
+	uint32_t mask = 0;
+	size_t i, j;
+
+	/* Load 4+4+2 deltas, padding the last vector with a repeat of deltas[8] */
+	v[0] = _mm256_loadu_si256((const __m256i *)deltas);
+	v[1] = _mm256_loadu_si256((const __m256i *)(deltas+4));
+	v[2] = _mm256_blendv_epi8(_mm256_set1_epi64x((long long)deltas[8]),
+	    _mm256_maskload_epi64((const long long *)(deltas+8), tailmask), tailmask);
+
+	lo = hi = _mm256_xor_si256(v[0], bias);
+	sum = sumsq = _mm256_setzero_si256();
+	for (i=0; i<ARRAY_SIZE(v); i++) {
+		__m256i b = _mm256_xor_si256(v[i], bias);
+		/* Mask out padding lanes for sums */
+		__m256i x = (i == 2) ? _mm256_and_si256(v[i], tailmask) : v[i];
+
+		sum   = _mm256_add_epi64(sum, x);
+		sumsq = _mm256_add_epi64(sumsq, _mm256_mul_epu32(x, x));
+
+		gt = _mm256_cmpgt_epi64(lo, b);
+		lo = _mm256_blendv_epi8(lo, b, gt);
+		gt = _mm256_cmpgt_epi64(b, hi);
+		hi = _mm256_blendv_epi8(hi, b, gt);
+		mask |= (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(
+		    _mm256_cmpgt_epi64(b, knee))) << (4*i);
+	}
+	mask &= (1u << BLOCK_DELTAS) - 1;
+
+	/* Horizontal min and max of 4 lanes */
+	_mm256_storeu_si256((__m256i *)lanes, _mm256_xor_si256(lo, bias));
+	bmin = lanes[0];
+	for (i=1; i<4; i++)
+		if (lanes[i] < bmin)
+			bmin = lanes[i];
+	_mm256_storeu_si256((__m256i *)lanes, _mm256_xor_si256(hi, bias));
+	bmax = lanes[0];
+	for (i=1; i<4; i++)
+		if (lanes[i] > bmax)
+			bmax = lanes[i];
+	if (bmin < sp->min)
+		sp->min = bmin;
+	if (bmax > sp->max)
+		sp->max = bmax;
+
+	/* Horizontal sums, with squares only meaningful if bmax < 2^30 */
+	__m128i s2 = _mm_add_epi64(_mm256_castsi256_si128(sum),
+	    _mm256_extracti128_si256(sum, 1));
+	__m128i q2 = _mm_add_epi64(_mm256_castsi256_si128(sumsq),
+	    _mm256_extracti128_si256(sumsq, 1));
+	stats_add_block(deltas, sp,
+	    (uint64_t)_mm_cvtsi128_si64(s2) + (uint64_t)_mm_extract_epi64(s2, 1),
+	    (uint64_t)_mm_cvtsi128_si64(q2) + (uint64_t)_mm_extract_epi64(q2, 1),
+	    bmax);
+
+	/* Bin index is a count of upper bounds below the delta */
+	for (i=0; i<BLOCK_DELTAS; i++) {
+		__m256i d = _mm256_set1_epi64x((long long)(deltas[i] ^ 0x8000000000000000ULL));
+		int idx = 0;
+
+		for (j=0; j<histo_ub_len; j+=4) {
+			__m256i ub = _mm256_xor_si256(
+			    _mm256_loadu_si256((const __m256i *)(histo_ub+j)), bias);
+			idx += __builtin_popcount(_mm256_movemask_pd(
+			    _mm256_castsi256_pd(_mm256_cmpgt_epi64(d, ub))));
+		}
+		histo[idx].delta_count++;
+		histo[idx].delta_sum += deltas[i];
+	}
+	return (mask);
+}
+
+/*! \brief AVX-512 analysis kernel (see block_fn_t) */
+__attribute__((target("avx512f")))
+uint32_t
+block_avx512(const uint64_t *deltas, stats_t *sp) {
+	const __mmask8 tail = (1u << (BLOCK_DELTAS-8)) - 1;
+	const __m512i knee = _mm512_set1_epi64((long long)args.knee);
+	__m512i v0, v1;
+	uint32_t mask;
+	size_t i, j;
+
+	/* Load 8+2 deltas, padding the last vector with a repeat of deltas[0] */
+	v0 = _mm512_loadu_si512((const void *)deltas);
+	v1 = _mm512_mask_loadu_epi64(_mm512_set1_epi64((long long)deltas[0]),
+	    tail, (const void *)(deltas+8));
+
+	uint64_t lo = _mm512_reduce_min_epu64(_mm512_min_epu64(v0, v1));
+	uint64_t hi = _mm512_reduce_max_epu64(_mm512_max_epu64(v0, v1));
+	if (lo < sp->min)
+		sp->min = lo;
+	if (hi > sp->max)
+		sp->max = hi;
+
+	/* Sums, with squares only meaningful if hi < 2^30 */
+	__m512i t = _mm512_maskz_mov_epi64(tail, v1);
+	stats_add_block(deltas, sp,
+	    (uint64_t)_mm512_reduce_add_epi64(_mm512_add_epi64(v0, t)),
+	    (uint64_t)_mm512_reduce_add_epi64(_mm512_add_epi64(
+	    _mm512_mul_epu32(v0, v0), _mm512_mul_epu32(t, t))),
+	    hi);
+
+	mask = _mm512_cmpgt_epu64_mask(v0, knee) |
+	    (uint32_t)(_mm512_cmpgt_epu64_mask(v1, knee) & tail) << 8;
+
+	/* Bin index is a count of upper bounds below the delta */
+	for (i=0; i<BLOCK_DELTAS; i++) {
+		__m512i d = _mm512_set1_epi64((long long)deltas[i]);
+		int idx = 0;
+
+		for (j=0; j<histo_ub_len; j+=8) {
+			idx += __builtin_popcount(_mm512_cmpgt_epu64_mask(d,
+			    _mm512_loadu_si512((const void *)(histo_ub+j))));
+		}
+		histo[idx].delta_count++;
+		histo[idx].delta_sum += deltas[i];
+	}
+	return (mask);
+}
+#endif	/* SIMD_KERNELS */
+
+/*!
+ * \brief Choose the analysis kernel
+ * \param name Kernel name from the command line, or NULL for the best available
+ * \return Kernel function, or NULL if the named kernel isn't usable here
+ */
+block_fn_t
+block_select(const char *name) {
+#ifdef	SIMD_KERNELS
+	__builtin_cpu_init();
+	if ((name==NULL || strcmp(name, "avx512")==0) &&
+	    __builtin_cpu_supports("avx512f"))
+		return (block_avx512);
+	if ((name==NULL || strcmp(name, "avx2")==0) &&
+	    __builtin_cpu_supports("avx2"))
+		return (block_avx2);
+#endif	/* SIMD_KERNELS */
+	if (name==NULL || strcmp(name, "scalar")==0)
+		return (block_scalar);
+	return (NULL);
+}
+
+/*!
+ * \brief Name an analysis kernel
+ * \param fn Kernel function from block_select()
+ * \return Kernel name as accepted by --kernel
+ */
+const char *
+block_name(block_fn_t fn) {
+#ifdef	SIMD_KERNELS
+	if (fn == block_avx512)
+		return ("avx512");
+	if (fn == block_avx2)
+		return ("avx2");
+#endif	/* SIMD_KERNELS */
+	return ("scalar");
+}
+
+/*!
+ * \brief Print the rotated histogram
+ * \param rp Results to print
+ */
+void
+histo_print(const results_t *rp) {
+	/* Print histogram headers */
+	printf("%sGraph ln(Count-e)\n", (args.sum) ? sum_graph_hdr : cnt_graph_hdr);
+
+	/* Find maximum delta count and sum in any histogram bin for scaling graph */
+	const bin_t *bp, *histo = rp->histo;
+	double tpns = rp->tpns;
+	uint64_t max_count=0, max_sum=0;
+	for (bp=histo; bp<histo+rp->bins; bp++) {
+		if (bp->delta_count > max_count)
+			max_count = bp->delta_count;
+		if (bp->delta_sum   > max_sum  )
+			max_sum   = bp->delta_sum  ;
+	}
+
+	/* Find a graph scaling value so that the maximum bin is full line width */
+	double graph_scale;
+	if (args.sum) {
+		graph_scale = (double)(args.linewid-strlen(cnt_graph_hdr))/log(((double)max_sum  )-M_E);
+	} else {
+		graph_scale = (double)(args.linewid-strlen(cnt_graph_hdr))/log(((double)max_count)-M_E);
+	}
+
+	/* Print histogram */
+	uint64_t c_count = 0;	/* Cumulative delta count as we step through bins */
+	uint64_t c_sum = 0;	/* Cumulative delta sum   as we step through bins */
+	for (bp=histo; bp<histo+rp->bins; bp++) {
+		c_count += bp->delta_count;
+		c_sum   += bp->delta_sum;
+
+		/* Format bin upper bound nicely into ub_str */
+		char *ub_str, ubbuf[99];
+		if (bp->ub == UINT64_MAX)
+			ub_str = "Infinite";
+		else {
+			sprintf(ubbuf, "%-8" PRIu64, bp->ub);
+			ub_str = ubbuf;
+		}
+
+		/*
+		 * Compute a logrithmic function on bin delta count or sum
+		 * that looks good.
+		 */
+		int graphwid;
+		if (args.sum) {
+			graphwid = graph_scale*log(((double)bp->delta_sum  )-M_E);
+		} else {
+			graphwid = graph_scale*log(((double)bp->delta_count)-M_E);
+		}
+
+		if (graphwid < 0)
+			graphwid = 0;
+		/*
+		 * Any nonzero delta count deserves a star, even though floating
+		 * point sometimes rounds down to zero stars.
+		 */
+		if (graphwid==0 && bp->delta_count!=0)
+			graphwid = 1;
+
+		/* Print a row for each bin */
+		if (args.sum) {
+			printf("%s  %s %-12" PRIu64 " %7.4f%%  %8.4f%%    %*.*s\n",
+			    t2ts(bp->ub, tpns), ub_str, bp->delta_sum,
+			    100.0*bp->delta_sum/rp->stats.sum, 100.0*c_sum/rp->stats.sum,
+			    graphwid, graphwid, graph_str);
+		} else {
+			printf("%s  %s %-12" PRIu64 " %7.4f%%  %8.4f%%    %*.*s\n",
+			    t2ts(bp->ub, tpns), ub_str, bp->delta_count,
+			    100.0*bp->delta_count/rp->stats.count, 100.0*c_count/rp->stats.count,
+			    graphwid, graphwid, graph_str);
+		}
+
+		/* Separate lower 1/2 of histogram from upper 1/2 */
+		assert(bp-histo+1 > 0);
+		if ((unsigned)(bp-histo+1) == rp->bins/2)
+			printf("\n");
+	}
+}
+
+/*!
+ * \brief Print overall statistics for a run
+ * \param rp Results to print
+ */
+void
+stats_print(const results_t *rp) {
+	/* Population standard deviation from the exact moments */
+	double std_dev = stats_std_dev(&rp->stats);
+
+	/* Print some useful statistics */
+	printf("\nTiming was measured for %s, %5.2f%% of runtime\n",
+	    t2ts(rp->timing_ticks, rp->tpns), 100.0*rp->timing_ticks/rp->run_ticks);
+	printf("CPU speed measured  : %7.2f MHz over %" PRIu64 " iterations\n",
+	    (double)rp->run_ticks/rp->run_us, rp->stats.count);
+	printf("Min / Average / Std Dev / Max :   %" PRIu64 "   /   %" PRIu64 "   /  %3.0f   / %" PRIu64 " ticks\n",
+	    rp->stats.min, rp->stats.sum/rp->stats.count, std_dev, rp->stats.max);
+	printf("Min / Average / Std Dev / Max : %s / %s / %s / %s\n",
+	    t2ts(rp->stats.min, rp->tpns), t2ts(rp->stats.sum/rp->stats.count, rp->tpns),
+	    t2ts((uint64_t)std_dev, rp->tpns), t2ts(rp->stats.max, rp->tpns));
+}
+
+/*!
+ * \brief Analyze results and recommend better min and knee settings
+ * \param rp      Results to analyze
+ * \param logging True if outliers were being logged
+ *
+ * Knee advice from the histogram is skipped while logging since advice
+ * based on the outlier buffer is given instead.
+ */
+void
+advise(const results_t *rp, int logging) {
+	const bin_t *bp;
+	uint64_t mid_count = 0;	/* Cumulative delta count at histogram midpoint */
+	uint64_t mid_sum = 0;	/* Cumulative delta sum   at histogram midpoint */
+
+	for (bp=rp->histo; bp<rp->histo+(rp->bins/2); bp++) {
+		mid_count += bp->delta_count;
+		mid_sum   += bp->delta_sum;
+	}
+
+	/* Analyze histogram to give advice on setting better min */
+	if (rp->stats.min<args.min || args.min<0.80*rp->stats.min) {
+		printf("Recommend min setting of %3.0f ticks\n", 0.80*rp->stats.min);
+	}
+
+	/* Analyze histogram to give advice on setting better knee */
+	if (args.sum) {
+		if (!logging && 100.0*mid_sum/rp->stats.sum<90.0) {
+			printf("Recommend increasing knee setting from %" PRIu64 " ticks\n",
+			    args.knee);
+		}
+		if (!logging && 100.0*mid_sum/rp->stats.sum>99.0) {
+			printf("Recommend decreasing knee setting from %" PRIu64 " ticks\n",
+			    args.knee);
+		}
+	} else {
+		if (!logging && 100.0*mid_count/rp->stats.count<90.0) {
+			printf("Recommend increasing knee setting from %" PRIu64 " ticks\n",
+			    args.knee);
+		}
+		if (!logging && 100.0*mid_count/rp->stats.count>99.0) {
+			printf("Recommend decreasing knee setting from %" PRIu64 " ticks\n",
+			    args.knee);
+		}
+	}
+}
+
+/*!
+ * \brief Read a whole file, such as one in /proc, into memory
+ * \param path Name of file
+ * \return malloc()'d NUL-terminated contents, or NULL if unreadable
+ *
+ * Files in /proc report a size of zero, so they are read until EOF.
+ */
+char *
+file_read(const char *path) {
+	char *buf = NULL, *nbuf;
+	size_t len = 0, size = 0, n;
+	FILE *fp;
+
+	if ((fp=fopen(path, "r")) == NULL)
+		return (NULL);
+	do {
+		if (size-len < 4096) {
+			size = size ? 2*size : 16384;
+			if ((nbuf=realloc(buf, size)) == NULL) {
+				free(buf);
+				fclose(fp);
+				return (NULL);
+			}
+			buf = nbuf;
+		}
+		n = fread(buf+len, 1, size-len-1, fp);
+		len += n;
+	} while (n > 0);
+	fclose(fp);
+	buf[len] = '\0';
+	return (buf);
+}
+
+/*!
+ * \brief Find host name and CPU model for snapshots
+ * \param host  Buffer to receive host name
+ * \param hlen  Length of host (bytes)
+ * \param model Buffer to receive CPU model from the CPUID brand string
+ * \param mlen  Length of model (bytes), at least 49
+ */
+void
+host_identity(char *host, size_t hlen, char *model, size_t mlen) {
+	uint32_t r[4];
+	char *p;
+
+#ifdef _WIN32
+	snprintf(host, hlen, "%s", getenv("COMPUTERNAME") ? getenv("COMPUTERNAME") : "unknown");
+#else	/* _WIN32 */
+	if (gethostname(host, hlen) != 0)
+		snprintf(host, hlen, "unknown");
+	host[hlen-1] = '\0';
+#endif	/* _WIN32 */
+
+	snprintf(model, mlen, "unknown");
+	cpuid(0x80000000, 0, r);
+	if (r[0] >= 0x80000004) {
+		for (uint32_t leaf=0x80000002; leaf<=0x80000004; leaf++) {
+			cpuid(leaf, 0, r);
+			memcpy(model+16*(leaf-0x80000002), r, sizeof(r));
+		}
+		model[48] = '\0';
+		/* Brand strings are often padded with leading spaces */
+		for (p=model; *p==' '; p++) {}
+		memmove(model, p, strlen(p)+1);
+	}
+}
+
+/*!
+ * \brief Detect a hypervisor from CPUID
+ * \param name Buffer to receive hypervisor name, at least 13 bytes
+ * \param len  Length of name (bytes)
+ * \return 1 if running under a hypervisor, 0 otherwise
+ *
+ * The hypervisor present bit is set by every major hypervisor, which then
+ * names itself with a vendor signature in leaf 0x40000000.
+ */
+int
+hv_detect(char *name, size_t len) {
+	/* Vendor signatures and the names they are better known by */
+	static const struct {
+		const char *sig, *name;
+	} known[] = {
+		{"KVMKVMKVM",    "KVM"},
+		{"Microsoft Hv", "Hyper-V"},
+		{"VMwareVMware", "VMware"},
+		{"XenVMMXenVMM", "Xen"},
+		{"TCGTCGTCGTCG", "QEMU"},
+		{"ACRNACRNACRN", "ACRN"},
+		{"bhyve bhyve ", "bhyve"},
+		{" lrpepyh  vr", "Parallels"},
+		{"VBoxVBoxVBox", "VirtualBox"},
+	};
+	uint32_t r[4];
+	char sig[13];
+	size_t i;
+
+	cpuid(1, 0, r);
+	if (!(r[2] & (1U<<31))) {
+		snprintf(name, len, "none detected");
+		return (0);
+	}
+	cpuid(0x40000000, 0, r);
+	memcpy(sig+0, &r[1], 4);
+	memcpy(sig+4, &r[2], 4);
+	memcpy(sig+8, &r[3], 4);
+	sig[12] = '\0';
+	for (i=0; i<ARRAY_SIZE(known); i++) {
+		if (strncmp(sig, known[i].sig, strlen(known[i].sig)) == 0) {
+			snprintf(name, len, "%s", known[i].name);
+			return (1);
+		}
+	}
+	snprintf(name, len, "unknown (%s)", sig);
+	return (1);
+}
+
+#ifdef	__linux__
+/*!
+ * \brief Find the CPUs being measured for steal time
+ * \param set CPUs to fill in
+ * \return 0 if found, -1 otherwise
+ *
+ * With -c these are the CPUs the test is pinned to, otherwise just the
+ * CPU it is on now, so steal elsewhere in the machine isn't counted.
+ */
+int
+steal_cpus(cpu_set_t *set) {
+	int cpu;
+
+	if (args.cpu != NULL)
+		return (sched_getaffinity(0, sizeof(*set), set));
+	if ((cpu=sched_getcpu()) < 0)
+		return (-1);
+	CPU_ZERO(set);
+	CPU_SET(cpu, set);
+	return (0);
+}
+
+/*!
+ * \brief Read steal time of the measured CPUs
+ * \param set Measured CPUs
+ * \return Steal time averaged over the measured CPUs (ms), or -1 if unavailable
+ *
+ * Steal is time a virtual CPU was runnable but the hypervisor ran something
+ * else, the 8th value on each cpuN line of /proc/stat.
+ * It is counted in clock ticks, usually 10 ms.
+ */
+double
+steal_ms(const cpu_set_t *set) {
+	unsigned long long v[8];
+	unsigned cpu;
+	double ms = 0;
+	char *text, *p;
+
+	if (CPU_COUNT(set) == 0 || (text=file_read("/proc/stat")) == NULL)
+		return (-1);
+	/* Per-CPU lines follow the total, which starts the file */
+	for (p=text; (p=strstr(p, "\ncpu")) != NULL; ) {
+		p += 4;
+		if (sscanf(p, "%u %llu %llu %llu %llu %llu %llu %llu %llu", &cpu,
+		    &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) == 9 &&
+		    cpu < CPU_SETSIZE && CPU_ISSET(cpu, set))
+			ms += v[7]*1000.0/sysconf(_SC_CLK_TCK);
+	}
+	free(text);
+	return (ms/CPU_COUNT(set));
+}
+#endif	/* __linux__ */
+
+/*!
+ * \brief Report hypervisor, rdtsc cost, and steal time
+ * \param rp    Results of the run
+ * \param steal Steal time during the run (ms), or -1 if unknown
+ *
+ * Back to back rdtsc takes tens of ticks natively, so a minimum delta far
+ * above that means rdtsc is trapped and emulated, which inflates every delta.
+ */
+void
+hv_report(const results_t *rp, double steal) {
+	char name[32];
+	int hv = hv_detect(name, sizeof(name));
+	double run_ms = rp->run_ticks/rp->tpns/1E6;
+	double stolen_ms = histo_stolen(rp)/rp->tpns/1E6;
+#ifdef	__linux__
+	double tick_ms = 1000.0/sysconf(_SC_CLK_TCK);
+#else	/* __linux__ */
+	double tick_ms = 10;
+#endif	/* __linux__ */
+
+	printf("Hypervisor              : %s, rdtsc %s per read%s\n", name,
+	    t2ts(rp->stats.min, rp->tpns),
+	    (rp->stats.min > RDTSC_TRAP_TICKS) ? ", likely trapped" : "");
+	if (steal < 0 || (!hv && steal == 0))
+		return;
+	printf("Steal time              : %.0fms, %.4f%% of runtime", steal,
+	    100.0*steal/run_ms);
+	/*
+	 * Steal is counted in whole clock ticks and can also fall outside
+	 * timing, so only compare it when time lost is at least a tick.
+	 */
+	if (stolen_ms >= tick_ms && steal > 0)
+		printf(", accounting for up to %.1f%% of time lost",
+		    (steal < stolen_ms) ? 100.0*steal/stolen_ms : 100.0);
+	printf("\n");
+}
+
+#ifdef	CPU_AFFINITY
+/*!
+ * \brief Report how much of the measured CPUs a CPU list covers
+ * \param fp    Audit report
+ * \param label Label for the report line
+ * \param list  CPU list, possibly with leading flags like "domain,", or NULL if unset
+ * \param cpus  Measured CPUs
+ * \param miss  What it means for a measured CPU to be missing from the list
+ */
+void
+audit_list(FILE *fp, const char *label, const char *list, const cpu_set_t *cpus,
+    const char *miss) {
+	cpu_set_t set, out;
+	char buf[256], outs[256];
+
+	/* Flags come first in isolcpus, like "nohz,domain,2-5" */
+	while (list != NULL && *list != '\0' && (*list < '0' || *list > '9')) {
+		list += strcspn(list, ",");
+		list += (*list == ',');
+	}
+	if (list == NULL || *list == '\0') {
+		fprintf(fp, "%-24s: not set, %s\n", label, miss);
+		return;
+	}
+	snprintf(buf, sizeof(buf), "%.*s", (int)strcspn(list, " \n"), list);
+	if (cpulist_parse(buf, &set) != 0) {
+		fprintf(fp, "%-24s: %s, unparsed\n", label, buf);
+		return;
+	}
+	CPU_XOR(&out, cpus, &set);
+	CPU_AND(&out, &out, cpus);
+	if (CPU_COUNT(&out) == 0)
+		fprintf(fp, "%-24s: %s, covers measured CPUs\n", label, buf);
+	else
+		fprintf(fp, "%-24s: %s, CPUs %s not in it, %s\n", label, buf,
+		    cpulist_str(&out, outs, sizeof(outs)), miss);
+}
+
+/*!
+ * \brief Add a name to a space separated list, ending it with "..." when full
+ * \param names List
+ * \param len   Length of names (bytes)
+ * \param name  Name to add
+ */
+void
+names_add(char *names, size_t len, const char *name) {
+	size_t used = strlen(names);
+
+	if (used >= 4 && strcmp(names+used-4, " ...") == 0)
+		return;
+	if (used+strlen(name)+5 < len)
+		snprintf(names+used, len-used, " %s", name);
+	else
+		snprintf(names+used, len-used, " ...");
+}
+
+/*!
+ * \brief Find a kernel command line parameter
+ * \param cmdline Kernel command line
+ * \param name    Parameter name with its '=', like "isolcpus="
+ * \return Value of the parameter, ended by a space, or NULL if not set
+ */
+const char *
+cmdline_param(const char *cmdline, const char *name) {
+	const char *p;
+
+	for (p=cmdline; (p=strstr(p, name)) != NULL; p++) {
+		if (p == cmdline || p[-1] == ' ')
+			return (p+strlen(name));
+	}
+	return (NULL);
+}
+
+/*!
+ * \brief Audit the isolation of the CPUs about to be measured
+ * \return malloc()'d report to print with the results, or NULL
+ *
+ * Everything is read before measuring so the audit doesn't disturb the
+ * run, and reported afterwards next to the histogram.
+ */
+char *
+audit_collect() {
+	cpu_set_t cpus, set;
+	char *report = NULL, *cmd, *text, *p, path[544], name[64], list[256];
+	const char *v;
+	size_t len = 0;
+	int irqs = 0, irqs_here = 0, kthreads = 0, runnable = 0, cpu, n;
+	char irq_names[AUDIT_NAMES] = "", kthread_names[AUDIT_NAMES] = "";
+	char runnable_names[AUDIT_NAMES] = "";
+	struct dirent *de, *te;
+	DIR *dp, *tdp;
+	FILE *fp;
+
+	if (sched_getaffinity(0, sizeof(cpus), &cpus) != 0 ||
+	    (fp=open_memstream(&report, &len)) == NULL)
+		return (NULL);
+	fprintf(fp, "%-24s: CPUs %s\n", "Isolation audit", cpulist_str(&cpus, list, sizeof(list)));
+
+	/* Boot parameters, from sysfs when the kernel reports what took effect */
+	cmd = file_read("/proc/cmdline");
+	text = file_read("/sys/devices/system/cpu/isolated");
+	audit_list(fp, "  isolcpus", (text != NULL) ? text :
+	    (cmd != NULL) ? cmdline_param(cmd, "isolcpus=") : NULL, &cpus,
+	    "other tasks may be scheduled there");
+	free(text);
+	text = file_read("/sys/devices/system/cpu/nohz_full");
+	if (text != NULL && strncmp(text, "(null)", 6) == 0)
+		text[0] = '\0';
+	audit_list(fp, "  nohz_full", (text != NULL) ? text :
+	    (cmd != NULL) ? cmdline_param(cmd, "nohz_full=") : NULL, &cpus,
+	    "the scheduler tick keeps running there");
+	free(text);
+	audit_list(fp, "  rcu_nocbs", (cmd != NULL) ? cmdline_param(cmd, "rcu_nocbs=") : NULL,
+	    &cpus, "RCU callbacks run there");
+	v = (cmd != NULL) ? cmdline_param(cmd, "irqaffinity=") : NULL;
+	if (v != NULL) {
+		snprintf(list, sizeof(list), "%.*s", (int)strcspn(v, " \n"), v);
+		if (cpulist_parse(list, &set) == 0) {
+			CPU_AND(&set, &set, &cpus);
+			fprintf(fp, "%-24s: %s, %s\n", "  irqaffinity", list,
+			    CPU_COUNT(&set) ? "includes measured CPUs" : "excludes measured CPUs");
+		}
+	} else {
+		fprintf(fp, "%-24s: not set, new IRQs may go to any CPU\n", "  irqaffinity");
+	}
+	free(cmd);
+
+	/* Interrupts that may be delivered to measured CPUs */
+	if ((dp=opendir("/proc/irq")) != NULL) {
+		while ((de=readdir(dp)) != NULL) {
+			if (de->d_name[0] < '0' || de->d_name[0] > '9')
+				continue;
+			irqs++;
+			snprintf(path, sizeof(path), "/proc/irq/%s/smp_affinity_list", de->d_name);
+			if ((text=file_read(path)) == NULL)
+				continue;
+			text[strcspn(text, "\n")] = '\0';
+			if (cpulist_parse(text, &set) == 0) {
+				CPU_AND(&set, &set, &cpus);
+				if (CPU_COUNT(&set) != 0) {
+					names_add(irq_names, sizeof(irq_names), de->d_name);
+					irqs_here++;
+				}
+			}
+			free(text);
+		}
+		closedir(dp);
+		fprintf(fp, "%-24s: %d of %d%s%s\n", "  IRQs allowed there", irqs_here, irqs,
+		    irqs_here ? ":" : "", irq_names);
+	}
+
+	/* Kernel threads and runnable tasks that last ran on measured CPUs */
+	if ((dp=opendir("/proc")) != NULL) {
+		while ((de=readdir(dp)) != NULL) {
+			if (de->d_name[0] < '0' || de->d_name[0] > '9' ||
+			    atoi(de->d_name) == getpid())
+				continue;
+			snprintf(path, sizeof(path), "/proc/%s/task", de->d_name);
+			if ((tdp=opendir(path)) == NULL)
+				continue;
+			while ((te=readdir(tdp)) != NULL) {
+				char state;
+				int ppid;
+
+				if (te->d_name[0] < '0' || te->d_name[0] > '9')
+					continue;
+				snprintf(path, sizeof(path), "/proc/%s/task/%s/stat",
+				    de->d_name, te->d_name);
+				if ((text=file_read(path)) == NULL)
+					continue;
+				/* Name may hold spaces and parentheses, so find the last ')' */
+				if ((p=strchr(text, '(')) == NULL || strrchr(text, ')') == NULL ||
+				    sscanf(strrchr(text, ')')+2, "%c %d", &state, &ppid) != 2) {
+					free(text);
+					continue;
+				}
+				snprintf(name, sizeof(name), "%.*s", (int)(strrchr(text, ')')-p-1), p+1);
+				/* Processor last run on is the 39th field, the 37th after the name */
+				for (p=strrchr(text, ')')+2, n=0; n<36 && p!=NULL; n++) {
+					if ((p=strchr(p, ' ')) != NULL)
+						p++;
+				}
+				cpu = (p != NULL) ? atoi(p) : -1;
+				free(text);
+				if (cpu < 0 || cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &cpus))
+					continue;
+				/* Kernel threads doing deferred work for CPUs */
+				if (ppid == 2) {
+					if (strncmp(name, "kworker", 7) == 0 ||
+					    strncmp(name, "rcu", 3) == 0 ||
+					    strncmp(name, "ksoftirqd", 9) == 0) {
+						names_add(kthread_names, sizeof(kthread_names), name);
+						kthreads++;
+					}
+				} else if (state == 'R') {
+					names_add(runnable_names, sizeof(runnable_names), name);
+					runnable++;
+				}
+			}
+			closedir(tdp);
+		}
+		closedir(dp);
+		fprintf(fp, "%-24s: %d%s%s\n", "  kworker/RCU/softirq", kthreads,
+		    kthreads ? ":" : "", kthread_names);
+		fprintf(fp, "%-24s: %d%s%s\n", "  Other runnable tasks", runnable,
+		    runnable ? ":" : "", runnable_names);
+	}
+	fclose(fp);
+	return (report);
+}
+#endif	/* CPU_AFFINITY */
+
+/*!
+ * \brief Copy the statistics that change during a run into a snapshot header
+ * \param sp Snapshot header to update
+ * \param rp Results to copy
+ */
+void
+snap_stats(snap_t *sp, const results_t *rp) {
+	sp->tpns = rp->tpns;
+	sp->timing_ticks = rp->timing_ticks;
+	sp->run_ticks = rp->run_ticks;
+	sp->run_us = rp->run_us;
+	sp->stat_min = rp->stats.min;
+	sp->stat_max = rp->stats.max;
+	sp->stat_count = rp->stats.count;
+	sp->stat_sum = rp->stats.sum;
+	sp->stat_sumsq_lo = (uint64_t)rp->stats.sumsq;
+#ifdef	__SIZEOF_INT128__
+	sp->stat_sumsq_hi = (uint64_t)(rp->stats.sumsq >> 64);
+#endif	/* __SIZEOF_INT128__ */
+}
+
+/*!
+ * \brief Fill in a snapshot header for the histogram following it
+ * \param sp       Snapshot header to fill in
+ * \param rp       Results to describe
+ * \param start_us Start of run (microseconds since the epoch)
+ */
+void
+snap_fill(snap_t *sp, const results_t *rp, uint64_t start_us) {
+	memset(sp, 0, sizeof(*sp));
+	strncpy(sp->magic, SNAP_MAGIC, sizeof(sp->magic));
+	sp->version = SNAP_VERSION;
+	sp->hdr_size = sizeof(*sp);
+	sp->bins_off = sizeof(*sp);
+	sp->file_size = sp->bins_off + sizeof(bin_t)*rp->bins;
+	sp->bins = rp->bins;
+	sp->knee = args.knee;
+	sp->min = args.min;
+	sp->runtime = args.runtime;
+	sp->pause = args.pause;
+	sp->logged = (outbuf != NULL);
+#ifdef	__linux__
+	sp->cpu = sched_getcpu();
+#else	/* __linux__ */
+	sp->cpu = -1;
+#endif	/* __linux__ */
+	sp->start_time = start_us/1000000;
+	snap_stats(sp, rp);
+	host_identity(sp->host, sizeof(sp->host), sp->cpu_model, sizeof(sp->cpu_model));
+	snprintf(sp->writer, sizeof(sp->writer), "%s", version);
+	snprintf(sp->cmdline, sizeof(sp->cmdline), "%s", cmdline);
+}
+
+/*!
+ * \brief Save results of a run as a binary snapshot
+ * \param path     Name of snapshot file
+ * \param rp       Results to save
+ * \param start_us Start of run (microseconds since the epoch)
+ * \return 0 if saved, -1 otherwise
+ */
+int
+snap_save(const char *path, const results_t *rp, uint64_t start_us) {
+	snap_t snap;
+	FILE *fp;
+
+	snap_fill(&snap, rp, start_us);
+
+	if ((fp=fopen(path, "wb")) == NULL) {
+		fprintf(stderr, "Unable to create snapshot file %s\n", path);
+		perror(path);
+		return (-1);
+	}
+	if (fwrite(&snap, sizeof(snap), 1, fp) != 1 ||
+	    fwrite(rp->histo, sizeof(bin_t), rp->bins, fp) != rp->bins) {
+		fprintf(stderr, "Unable to write snapshot file %s\n", path);
+		fclose(fp);
+		return (-1);
+	}
+	fclose(fp);
+	return (0);
+}
+
+/*!
+ * \brief Map a snapshot file into memory and check that it's usable
+ * \param path Name of snapshot file
+ * \return Pointer to mapped snapshot, or NULL if it couldn't be used
+ *
+ * The mapping is never unmapped; results point into it.
+ */
+const snap_t *
+snap_map(const char *path) {
+	const snap_t *sp;
+	FILE *fp;
+	long size;
+
+	if ((fp=fopen(path, "rb")) == NULL) {
+		perror(path);
+		return (NULL);
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	if (size < (long)sizeof(snap_t)) {
+		fprintf(stderr, "%s: too short to be a snapshot\n", path);
+		fclose(fp);
+		return (NULL);
+	}
+#ifndef _WIN32
+	sp = (const snap_t *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+	fclose(fp);
+	if (sp == MAP_FAILED) {
+		perror(path);
+		return (NULL);
+	}
+#else	/* _WIN32 */
+	void *buf;
+	rewind(fp);
+	if ((buf=malloc(size)) == NULL || fread(buf, size, 1, fp) != 1) {
+		fprintf(stderr, "%s: unable to read snapshot\n", path);
+		fclose(fp);
+		return (NULL);
+	}
+	fclose(fp);
+	sp = (const snap_t *)buf;
+#endif	/* _WIN32 */
+
+	if (memcmp(sp->magic, SNAP_MAGIC, sizeof(SNAP_MAGIC)) != 0) {
+		fprintf(stderr, "%s: not a snapshot file\n", path);
+		return (NULL);
+	}
+	if (sp->version != SNAP_VERSION) {
+		fprintf(stderr, "%s: snapshot version %u, expected %u\n",
+		    path, sp->version, SNAP_VERSION);
+		return (NULL);
+	}
+	/* Compare counts, not sizes, so a crafted bin count can't wrap */
+	if (sp->file_size != (uint64_t)size || sp->bins_off%8 != 0 ||
+	    sp->bins_off > (uint64_t)size || sp->bins < 2 ||
+	    sp->bins > (size-sp->bins_off)/sizeof(bin_t)) {
+		fprintf(stderr, "%s: snapshot is truncated or corrupt\n", path);
+		return (NULL);
+	}
+	if (sp->stat_count == 0) {
+		fprintf(stderr, "%s: snapshot has no deltas\n", path);
+		return (NULL);
+	}
+	return (sp);
+}
+
+/*!
+ * \brief Get results from a mapped snapshot
+ * \param sp Mapped snapshot
+ * \param rp Results to fill in, with histogram pointing into the mapping
+ */
+void
+snap_results(const snap_t *sp, results_t *rp) {
+	rp->histo = (bin_t *)((const char *)sp+sp->bins_off);
+	rp->bins = sp->bins;
+	rp->stats.min = sp->stat_min;
+	rp->stats.max = sp->stat_max;
+	rp->stats.count = sp->stat_count;
+	rp->stats.sum = sp->stat_sum;
+	rp->stats.sumsq = sp->stat_sumsq_lo;
+#ifdef	__SIZEOF_INT128__
+	rp->stats.sumsq |= (sumsq_t)sp->stat_sumsq_hi << 64;
+#else	/* __SIZEOF_INT128__ */
+	rp->stats.sumsq += sp->stat_sumsq_hi * 18446744073709551616.0L;
+#endif	/* __SIZEOF_INT128__ */
+	rp->tpns = sp->tpns;
+	rp->timing_ticks = sp->timing_ticks;
+	rp->run_ticks = sp->run_ticks;
+	rp->run_us = sp->run_us;
+}
+
+/*!
+ * \brief Report on a saved snapshot with the same output as a live run
+ * \param path Name of snapshot file
+ * \return 0 if reported, 1 otherwise
+ */
+int
+snap_report(const char *path) {
+	const snap_t *sp;
+	results_t results;
+	time_t when;
+
+	if ((sp=snap_map(path)) == NULL)
+		return (1);
+	snap_results(sp, &results);
+
+	/* Report with the snapshot's histogram settings */
+	args.bins = sp->bins;
+	args.knee = sp->knee;
+	args.min = sp->min;
+	histo_print(&results);
+	stats_print(&results);
+	when = (time_t)sp->start_time;
+	printf("Snapshot of %s CPU %d (%s) taken %s", sp->host, sp->cpu,
+	    sp->cpu_model, ctime(&when));
+	printf("Snapshot command line   : %s\n", sp->cmdline);
+	advise(&results, sp->logged);
+	return (0);
+}
+
+#ifndef _WIN32
+/*! Type for one snapshot file being aggregated by its own reader thread */
+typedef struct agg_stct {
+/*! Name of snapshot file */
+	char *path;
+/*! Mapped snapshot, or NULL if unusable */
+	const snap_t *sp;
+/*! Results from this snapshot alone */
+	results_t own;
+/*! Histogram settings of this snapshot */
+	uint64_t bins, knee, min;
+/*! Ticks per nanosecond of this snapshot */
+	double tpns;
+/*! Results merged from this and partner snapshots in the reduction tree */
+	results_t acc;
+/*! Number of snapshots merged into acc */
+	int merged;
+/*! Number of snapshots skipped because their histograms didn't match */
+	int skipped;
+/*! Number of snapshots skipped because their TSC rate didn't match */
+	int skipped_tpns;
+/*! 99.99th percentile (ns) */
+	double p9999;
+/*! Maximum delta (ns) */
+	double max;
+/*! Stolen time as a percentage of runtime */
+	double stolen;
+/*! Robust z-scores for p9999, max, and stolen */
+	double z[3];
+/*! Reader thread */
+	pthread_t tid;
+} agg_t;
+
+/*! Snapshots being aggregated */
+agg_t *aggs;
+/*! Number of snapshots being aggregated */
+size_t n_aggs;
+/*! Number of reader threads that have finished mapping their snapshot */
+size_t n_mapped;
+/*! Index of a snapshot with the histogram settings used by most of the fleet */
+size_t agg_ref;
+/*! Protects n_mapped */
+pthread_mutex_t agg_mutex = PTHREAD_MUTEX_INITIALIZER;
+/*! Signaled when agg_ref has been chosen */
+pthread_cond_t agg_cond = PTHREAD_COND_INITIALIZER;
+
+/*!
+ * \brief Check whether two snapshots ran at the same TSC rate
+ * \param a One snapshot
+ * \param b The other snapshot
+ * \return Nonzero if their ticks per nanosecond are within AGG_TPNS_PCT
+ *
+ * Histograms are in ticks, so merging across TSC rates would mix
+ * different times in the same bin.
+ */
+static int
+agg_same_tpns(const agg_t *a, const agg_t *b) {
+	return (fabs(a->tpns-b->tpns) <= b->tpns*AGG_TPNS_PCT/100);
+}
+
+/*!
+ * \brief Choose the most common histogram settings among mapped snapshots
+ *
+ * Bins, knee, and min completely determine bin layout, so snapshots that
+ * match on them and on TSC rate can be merged.
+ */
+static void
+agg_choose_ref() {
+	size_t i, j, best = 0, votes;
+
+	agg_ref = n_aggs;
+	for (i=0; i<n_aggs; i++) {
+		if (aggs[i].sp == NULL)
+			continue;
+		for (votes=0, j=0; j<n_aggs; j++) {
+			if (aggs[j].sp!=NULL && aggs[j].bins==aggs[i].bins &&
+			    aggs[j].knee==aggs[i].knee && aggs[j].min==aggs[i].min &&
+			    agg_same_tpns(&aggs[j], &aggs[i]))
+				votes++;
+		}
+		if (votes > best) {
+			best = votes;
+			agg_ref = i;
+		}
+	}
+}
+
+/*!
+ * \brief Reader thread: map one snapshot, then merge partners in a reduction tree
+ * \param arg Pointer to this thread's agg_t
+ * \return NULL
+ *
+ * Once every snapshot is mapped, the last reader chooses the histogram
+ * settings to merge.
+ * Then thread i merges thread i+1, i+2, i+4, ... as long as i is a
+ * multiple of twice the stride, so thread 0 ends up with the whole fleet.
+ * Threads are created in reverse order so every partner exists before
+ * anyone joins it.
+ */
+static void *
+agg_reader(void *arg) {
+	agg_t *ap = (agg_t *)arg;
+	size_t i = ap-aggs, stride;
+	results_t *rp = &ap->own;
+
+	if ((ap->sp=snap_map(ap->path)) != NULL) {
+		snap_results(ap->sp, rp);
+		ap->bins = ap->sp->bins;
+		ap->knee = ap->sp->knee;
+		ap->min  = ap->sp->min;
+		ap->tpns = rp->tpns;
+		ap->p9999  = histo_percentile(rp, 99.99)/rp->tpns;
+		ap->stolen = 100.0*histo_stolen(rp)/rp->run_ticks;
+		ap->max    = rp->stats.max/rp->tpns;
+	}
+
+	/* Wait for all snapshots to be mapped and the settings to be chosen */
+	pthread_mutex_lock(&agg_mutex);
+	if (++n_mapped == n_aggs) {
+		agg_choose_ref();
+		pthread_cond_broadcast(&agg_cond);
+	}
+	while (n_mapped < n_aggs)
+		pthread_cond_wait(&agg_cond, &agg_mutex);
+	pthread_mutex_unlock(&agg_mutex);
+
+	if (ap->sp != NULL) {
+		agg_t *refp = &aggs[agg_ref];
+		if (ap->bins!=refp->bins || ap->knee!=refp->knee || ap->min!=refp->min) {
+			ap->skipped = 1;
+		} else if (!agg_same_tpns(ap, refp)) {
+			ap->skipped_tpns = 1;
+		} else {
+			/* Copy histogram since the mapping is read only */
+			ap->acc = *rp;
+			if ((ap->acc.histo=malloc(sizeof(bin_t)*ap->bins)) == NULL) {
+				fprintf(stderr, "Couldn't allocate memory for aggregation\n");
+				exit(1);
+			}
+			memcpy(ap->acc.histo, rp->histo, sizeof(bin_t)*ap->bins);
+			ap->merged = 1;
+		}
+	}
+
+	for (stride=1; i%(2*stride)==0 && i+stride<n_aggs; stride*=2) {
+		agg_t *pp = &aggs[i+stride];
+
+		pthread_join(pp->tid, NULL);
+		ap->skipped += pp->skipped;
+		ap->skipped_tpns += pp->skipped_tpns;
+		if (pp->merged == 0)
+			continue;
+		if (ap->merged == 0) {
+			/* Adopt partner's histogram, and its bin count, if we have none */
+			ap->acc = pp->acc;
+			ap->merged = pp->merged;
+			continue;
+		}
+		for (uint64_t b=0; b<ap->acc.bins; b++) {
+			ap->acc.histo[b].delta_count += pp->acc.histo[b].delta_count;
+			ap->acc.histo[b].delta_sum   += pp->acc.histo[b].delta_sum;
+		}
+		stats_merge(&ap->acc.stats, &pp->acc.stats);
+		ap->acc.timing_ticks += pp->acc.timing_ticks;
+		ap->acc.run_ticks    += pp->acc.run_ticks;
+		ap->acc.run_us       += pp->acc.run_us;
+		ap->merged += pp->merged;
+	}
+	return (NULL);
+}
+
+/*!
+ * \brief Compute robust z-scores of one metric across all usable snapshots
+ * \param metric Offset of the metric in agg_t
+ * \param zi     Index in agg_t z[] to receive the scores
+ *
+ * Uses the median and median absolute deviation so that a few bad hosts
+ * can't hide themselves by inflating the spread.
+ */
+static void
+agg_zscores(size_t metric, int zi) {
+	double *v, med, mad;
+	size_t i, n = 0;
+
+	if ((v=malloc(sizeof(double)*n_aggs)) == NULL)
+		return;
+	for (i=0; i<n_aggs; i++)
+		if (aggs[i].sp != NULL)
+			v[n++] = *(double *)((char *)&aggs[i]+metric);
+	if (n == 0) {
+		free(v);
+		return;
+	}
+	qsort(v, n, sizeof(double), dbl_cmp);
+	med = (n%2) ? v[n/2] : (v[n/2-1]+v[n/2])/2;
+	for (i=0; i<n; i++)
+		v[i] = fabs(v[i]-med);
+	qsort(v, n, sizeof(double), dbl_cmp);
+	mad = (n%2) ? v[n/2] : (v[n/2-1]+v[n/2])/2;
+	for (i=0; i<n_aggs; i++) {
+		double x = *(double *)((char *)&aggs[i]+metric);
+		if (aggs[i].sp == NULL)
+			continue;
+		if (mad > 0)
+			aggs[i].z[zi] = 0.6745*(x-med)/mad;
+		else
+			aggs[i].z[zi] = (x > med) ? HUGE_VAL : 0.0;
+	}
+	free(v);
+}
+
+/*! Metric that agg_cmp() sorts on, as an offset in agg_t */
+static size_t agg_sort_metric;
+
+/*! \brief qsort() comparison putting worst snapshot first on agg_sort_metric */
+static int
+agg_cmp(const void *a, const void *b) {
+	const agg_t *pa = *(agg_t * const *)a, *pb = *(agg_t * const *)b;
+	double va = *(const double *)((const char *)pa+agg_sort_metric);
+	double vb = *(const double *)((const char *)pb+agg_sort_metric);
+
+	return ((va < vb) - (va > vb));
+}
+
+/*!
+ * \brief Aggregate a directory of snapshots into a fleet report
+ * \param dir Directory holding *.slj snapshot files
+ * \return 0 if reported, 1 otherwise
+ */
+int
+aggregate(const char *dir) {
+	DIR *dp;
+	struct dirent *de;
+	pthread_attr_t attr;
+	agg_t **sorted;
+	size_t i, n_ok = 0, alloced = 0;
+
+	if ((dp=opendir(dir)) == NULL) {
+		perror(dir);
+		return (1);
+	}
+	while ((de=readdir(dp)) != NULL) {
+		size_t len = strlen(de->d_name);
+		if (len<5 || strcmp(de->d_name+len-4, ".slj")!=0)
+			continue;
+		if (n_aggs == alloced) {
+			alloced = alloced ? 2*alloced : 64;
+			if ((aggs=realloc(aggs, sizeof(agg_t)*alloced)) == NULL) {
+				fprintf(stderr, "Couldn't allocate memory for aggregation\n");
+				exit(1);
+			}
+		}
+		memset(&aggs[n_aggs], 0, sizeof(agg_t));
+		asprintf(&aggs[n_aggs].path, "%s/%s", dir, de->d_name);
+		n_aggs++;
+	}
+	closedir(dp);
+	if (n_aggs == 0) {
+		fprintf(stderr, "No snapshot (*.slj) files found in %s\n", dir);
+		return (1);
+	}
+
+	/* One reader per file, created last to first for the reduction tree */
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, AGG_STACK);
+	for (i=n_aggs; i-->0; ) {
+		if (pthread_create(&aggs[i].tid, &attr, agg_reader, &aggs[i]) != 0) {
+			fprintf(stderr, "Couldn't create aggregation reader thread\n");
+			exit(1);
+		}
+	}
+	pthread_join(aggs[0].tid, NULL);
+
+	if (aggs[0].merged == 0) {
+		fprintf(stderr, "No usable snapshots found in %s\n", dir);
+		return (1);
+	}
+
+	/* Report fleet histogram using the merged histogram settings */
+	args.bins = aggs[agg_ref].bins;
+	args.knee = aggs[agg_ref].knee;
+	args.min  = aggs[agg_ref].min;
+	/* Merged snapshots all ran within AGG_TPNS_PCT of the same TSC rate */
+	aggs[0].acc.tpns = aggs[0].acc.run_ticks/1000.0/aggs[0].acc.run_us;
+	histo_print(&aggs[0].acc);
+	stats_print(&aggs[0].acc);
+	printf("Fleet of %d snapshots merged", aggs[0].merged);
+	if (aggs[0].skipped)
+		printf(", %d skipped for different histogram settings",
+		    aggs[0].skipped);
+	if (aggs[0].skipped_tpns)
+		printf(", %d skipped for TSC rate more than %g%% from %.3f ticks/ns",
+		    aggs[0].skipped_tpns, AGG_TPNS_PCT, aggs[agg_ref].tpns);
+	printf("\n");
+
+	/* Rank individual hosts and cores */
+	agg_zscores(offsetof(agg_t, p9999),  0);
+	agg_zscores(offsetof(agg_t, max),    1);
+	agg_zscores(offsetof(agg_t, stolen), 2);
+	if ((sorted=malloc(sizeof(agg_t *)*n_aggs)) == NULL) {
+		fprintf(stderr, "Couldn't allocate memory for aggregation\n");
+		exit(1);
+	}
+	for (i=0; i<n_aggs; i++) {
+		if (aggs[i].sp != NULL)
+			sorted[n_ok++] = &aggs[i];
+		else
+			printf("Unusable snapshot skipped: %s\n", aggs[i].path);
+	}
+
+	const struct {
+		const char *name;
+		size_t metric;
+	} ranks[] = {
+		{"p99.99",      offsetof(agg_t, p9999)},
+		{"max",         offsetof(agg_t, max)},
+		{"stolen time", offsetof(agg_t, stolen)},
+	};
+	for (size_t r=0; r<ARRAY_SIZE(ranks); r++) {
+		agg_sort_metric = ranks[r].metric;
+		qsort(sorted, n_ok, sizeof(agg_t *), agg_cmp);
+		printf("\nWorst hosts and cores by %s\n", ranks[r].name);
+		printf("Rank  Host                     CPU    p99.99      Max   Stolen\n");
+		for (i=0; i<n_ok && i<AGG_ROWS; i++) {
+			agg_t *ap = sorted[i];
+			printf("%4zu  %-24.24s %3d  %8s %8s  %6.4f%%\n", i+1,
+			    ap->sp->host, ap->sp->cpu,
+			    t2ts((uint64_t)ap->p9999, 1.0), t2ts((uint64_t)ap->max, 1.0),
+			    ap->stolen);
+		}
+	}
+
+	/* Flag hosts that stand out from the fleet on any metric */
+	printf("\nOutliers (robust z-score > %.1f)\n", AGG_OUTLIER_Z);
+	int flagged = 0;
+	for (i=0; i<n_ok; i++) {
+		agg_t *ap = sorted[i];
+		for (size_t r=0; r<ARRAY_SIZE(ranks); r++) {
+			if (ap->z[r] > AGG_OUTLIER_Z) {
+				printf("%-24.24s CPU %3d  %-11s z=%5.1f  %s\n",
+				    ap->sp->host, ap->sp->cpu, ranks[r].name, ap->z[r],
+				    ap->path);
+				flagged++;
+			}
+		}
+	}
+	if (flagged == 0)
+		printf("None\n");
+	return (0);
+}
+#endif	/* _WIN32 */
+
+#ifndef _WIN32
+/*! Type for one outlier read back from an outlier file */
+typedef struct replay_stct {
+/*! Time of outlier relative to start of test (ms) */
+	double ms;
+/*! Size of outlier (us) */
+	double us;
+} replay_t;
+
+/*! Type for one chunk of an outlier file parsed by its own thread */
+typedef struct chunk_stct {
+/*! First character of chunk */
+	const char *start;
+/*! One past last character of chunk */
+	const char *end;
+/*! Outliers parsed from chunk */
+	replay_t *outliers;
+/*! Number of outliers parsed from chunk */
+	size_t n;
+/*! Parser thread */
+	pthread_t tid;
+} chunk_t;
+
+/*!
+ * \brief Parser thread: parse "ms, us" lines from one chunk of an outlier file
+ * \param arg Pointer to this thread's chunk_t
+ * \return NULL
+ */
+static void *
+chunk_parse(void *arg) {
+	chunk_t *cp = (chunk_t *)arg;
+	const char *p = cp->start;
+	size_t alloced = 0;
+	char line[99];
+
+	while (p < cp->end) {
+		const char *nl = memchr(p, '\n', cp->end-p);
+		size_t len = (nl ? nl : cp->end) - p;
+		replay_t r;
+
+		/* Copy line so strtod() can't run past the end of the mapping */
+		if (len >= sizeof(line))
+			len = sizeof(line)-1;
+		memcpy(line, p, len);
+		line[len] = '\0';
+		p = nl ? nl+1 : cp->end;
+
+		if (sscanf(line, "%lf , %lf", &r.ms, &r.us) != 2)
+			continue;
+		if (cp->n == alloced) {
+			alloced = alloced ? 2*alloced : 1024;
+			if ((cp->outliers=realloc(cp->outliers, sizeof(replay_t)*alloced)) == NULL) {
+				fprintf(stderr, "Couldn't allocate memory for replay\n");
+				exit(1);
+			}
+		}
+		cp->outliers[cp->n++] = r;
+	}
+	return (NULL);
+}
+
+/*! \brief qsort() comparison for replayed outliers in time order */
+static int
+replay_cmp(const void *a, const void *b) {
+	return (dbl_cmp(&((const replay_t *)a)->ms, &((const replay_t *)b)->ms));
+}
+
+/*!
+ * \brief Look for a period in outlier times
+ * \param rp     Outliers above the knee, in time order
+ * \param n      Number of outliers
+ * \param period Receives the period found (ms)
+ * \return Strength of period as a multiple of what random times would give, 0 if none
+ *
+ * Builds a histogram of time differences between all pairs of outliers up
+ * to REPLAY_PERIOD_MAX apart.
+ * Random times give a flat histogram while periodic ones give peaks at
+ * multiples of the period.
+ * Pairs of adjacent lag bins are scored together so a peak split across a
+ * bin boundary isn't halved.
+ * The shortest lag whose peak is at least half as strong as the strongest
+ * is taken as the fundamental period.
+ */
+static double
+replay_period(const replay_t *rp, size_t n, double *period) {
+	double span, maxlag, expect, best = 0.0;
+	size_t nbins, i, j, b;
+	uint64_t *lags;
+
+	if (n < 3)
+		return (0.0);
+	span = rp[n-1].ms - rp[0].ms;
+	maxlag = (span/2 < REPLAY_PERIOD_MAX) ? span/2 : REPLAY_PERIOD_MAX;
+	nbins = (size_t)(maxlag/REPLAY_PERIOD_BIN);
+	if (nbins < 2)
+		return (0.0);
+	if ((lags=calloc(nbins, sizeof(uint64_t))) == NULL)
+		return (0.0);
+
+	for (i=0; i<n; i++) {
+		for (j=i+1; j<n && rp[j].ms-rp[i].ms<maxlag; j++) {
+			b = (size_t)((rp[j].ms-rp[i].ms)/REPLAY_PERIOD_BIN);
+			if (b < nbins)
+				lags[b]++;
+		}
+	}
+
+	/* Pairs expected per bin at lag l from random times is about n^2 w (span-l) / span^2 */
+	double *strength = malloc(sizeof(double)*nbins);
+	if (strength == NULL) {
+		free(lags);
+		return (0.0);
+	}
+	strength[nbins-1] = 0.0;
+	/* Lags just past the burst gap are crowded by the merging, so skip them */
+	for (b=0; b<nbins-1 && b<2*REPLAY_BURST_GAP/REPLAY_PERIOD_BIN; b++)
+		strength[b] = 0.0;
+	for (; b<nbins-1; b++) {
+		double lag = (b+1)*REPLAY_PERIOD_BIN;
+		uint64_t pair = lags[b]+lags[b+1];
+		expect = 2.0*n*n*REPLAY_PERIOD_BIN*(span-lag)/(span*span);
+		strength[b] = (pair >= 5) ? pair/expect : 0.0;
+		if (strength[b] > best)
+			best = strength[b];
+	}
+	for (b=0; b<nbins-1; b++) {
+		if (strength[b] >= 0.5*best) {
+			/* Find the peak of this lobe and center on its pair of bins */
+			for (; b+1<nbins-1 && strength[b+1]>strength[b]; b++) {}
+			*period = ((b+0.5)*lags[b] + (b+1.5)*lags[b+1]) *
+			    REPLAY_PERIOD_BIN / (lags[b]+lags[b+1]);
+			best = strength[b];
+			break;
+		}
+	}
+	free(strength);
+	free(lags);
+	return ((best >= REPLAY_PERIOD_MIN) ? best : 0.0);
+}
+
+/*!
+ * \brief Re-analyze an outlier file written by -f without a new test
+ * \param path Name of outlier file
+ * \return 0 if reported, 1 otherwise
+ *
+ * The file is mapped and split into one chunk per online CPU, each parsed
+ * by its own thread.
+ * Outliers are histogrammed with the current histogram settings, so old
+ * logs can be re-analyzed with a new knee.
+ */
+int
+replay(const char *path) {
+	struct stat st;
+	const char *map;
+	chunk_t *chunks;
+	replay_t *outliers, *above;
+	size_t n_chunks, n = 0, n_above = 0, i;
+	double tpns;
+	int fd;
+
+	if ((fd=open(path, O_RDONLY)) < 0 || fstat(fd, &st) != 0) {
+		perror(path);
+		return (1);
+	}
+	if (st.st_size == 0) {
+		fprintf(stderr, "%s: empty outlier file\n", path);
+		return (1);
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror(path);
+		return (1);
+	}
+
+	/* Split at line boundaries, one chunk per CPU */
+	n_chunks = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n_chunks < 1)
+		n_chunks = 1;
+	if ((chunks=calloc(n_chunks, sizeof(chunk_t))) == NULL) {
+		fprintf(stderr, "Couldn't allocate memory for replay\n");
+		exit(1);
+	}
+	const char *p = map, *end = map+st.st_size;
+	for (i=0; i<n_chunks; i++) {
+		const char *ce = (i == n_chunks-1) ? end : p+(end-p)/(n_chunks-i);
+		const char *nl = (ce < end) ? memchr(ce, '\n', end-ce) : NULL;
+
+		chunks[i].start = p;
+		chunks[i].end = (ce == end || nl == NULL) ? end : nl+1;
+		p = chunks[i].end;
+		if (pthread_create(&chunks[i].tid, NULL, chunk_parse, &chunks[i]) != 0) {
+			fprintf(stderr, "Couldn't create replay parser thread\n");
+			exit(1);
+		}
+	}
+	for (i=0; i<n_chunks; i++) {
+		pthread_join(chunks[i].tid, NULL);
+		n += chunks[i].n;
+	}
+	if (n == 0) {
+		fprintf(stderr, "%s: no outliers found\n", path);
+		return (1);
+	}
+
+	/* Gather chunks and put in time order since the outlier ring may have wrapped */
+	if ((outliers=malloc(sizeof(replay_t)*n)) == NULL ||
+	    (above=malloc(sizeof(replay_t)*n)) == NULL) {
+		fprintf(stderr, "Couldn't allocate memory for replay\n");
+		exit(1);
+	}
+	for (n=0, i=0; i<n_chunks; i++) {
+		memcpy(outliers+n, chunks[i].outliers, sizeof(replay_t)*chunks[i].n);
+		n += chunks[i].n;
+		free(chunks[i].outliers);
+	}
+	qsort(outliers, n, sizeof(replay_t), replay_cmp);
+
+	tpns = (args.tpns > 0) ? args.tpns : tsc_calibrate(CALIBRATE_MS);
+
+	/* Histogram outliers with current settings */
+	if (histo_setup() != 0) {
+		fprintf(stderr, "Couldn't allocate memory for histogram bins\n");
+		exit(1);
+	}
+	results_t results;
+	memset(&results, 0, sizeof(results));
+	results.histo = histo;
+	results.bins = args.bins;
+	results.tpns = tpns;
+	results.stats.min = UINT64_MAX;
+	uint64_t stolen = 0;
+	for (i=0; i<n; i++) {
+		uint64_t d = (uint64_t)(outliers[i].us*1000.0*tpns + 0.5);
+		bin_t *bp;
+
+		for (bp=histo; d>bp->ub; bp++) {}
+		bp->delta_count++;
+		bp->delta_sum += d;
+
+		if (d < results.stats.min)
+			results.stats.min = d;
+		if (d > results.stats.max)
+			results.stats.max = d;
+		results.stats.count++;
+		results.stats.sum += d;
+		results.stats.sumsq += (sumsq_t)d*d;
+
+		if (d > args.knee) {
+			above[n_above++] = outliers[i];
+			stolen += d - args.min;
+		}
+	}
+	histo_print(&results);
+
+	double span = outliers[n-1].ms - outliers[0].ms;
+	printf("\nReplayed %zu outliers from %s spanning %s at %.2f ticks/ns (%s)\n",
+	    n, path, t2ts((uint64_t)(span*1E6), 1.0), tpns,
+	    (args.tpns > 0) ? "given" : "calibrated on this host");
+	printf("Min / Average / Std Dev / Max : %s / %s / %s / %s\n",
+	    t2ts(results.stats.min, tpns),
+	    t2ts(results.stats.sum/results.stats.count, tpns),
+	    t2ts((uint64_t)stats_std_dev(&results.stats), tpns),
+	    t2ts(results.stats.max, tpns));
+	printf("Above knee of %" PRIu64 " ticks: %zu outliers, %s stolen beyond min, %5.3f%% of span\n",
+	    args.knee, n_above, t2ts(stolen, tpns),
+	    (span > 0) ? 100.0*stolen/tpns/(span*1E6) : 0.0);
+
+	/* Periodicity of bursts of outliers above the knee */
+	size_t n_bursts = 0;
+	for (i=0; i<n_above; i++) {
+		if (n_bursts==0 || above[i].ms-above[n_bursts-1].ms >= REPLAY_BURST_GAP)
+			above[n_bursts++] = above[i];
+	}
+	n_above = n_bursts;
+	if (n_above >= 2) {
+		double mean = (above[n_above-1].ms-above[0].ms)/(n_above-1);
+		double svn = 0.0, period = 0.0, strength;
+
+		for (i=1; i<n_above; i++) {
+			double gap = above[i].ms-above[i-1].ms;
+			svn += (gap-mean)*(gap-mean);
+		}
+		double sd = sqrt(svn/(n_above-1));
+		printf("Interval between bursts: mean %s, std dev %s, CV %.2f%s\n",
+		    t2ts((uint64_t)(mean*1E6), 1.0), t2ts((uint64_t)(sd*1E6), 1.0),
+		    (mean > 0) ? sd/mean : 0.0,
+		    (mean > 0 && sd/mean < 0.5) ? " (regular)" :
+		    (mean > 0 && sd/mean < 1.5) ? " (random)" : " (bursty)");
+		if ((strength=replay_period(above, n_above, &period)) > 0) {
+			printf("Periodicity: bursts recur every %s, %.1fx stronger than random\n",
+			    t2ts((uint64_t)(period*1E6), 1.0), strength);
+		} else {
+			printf("Periodicity: none found\n");
+		}
+	}
+	return (0);
+}
+#endif	/* _WIN32 */
+
+#ifndef _WIN32
+/*! Type for one chunk of raw deltas handed from the timing thread to the trace writer */
+typedef struct trace_chunk_stct {
+/*! Number of deltas in chunk */
+	uint64_t n;
+/*! Number of deltas dropped just before this chunk */
+	uint64_t dropped;
+/*! Raw deltas (ticks) */
+	uint64_t deltas[TRACE_CHUNK_DELTAS];
+} trace_chunk_t;
+
+/*!
+ * \brief Type for the state of trace capture
+ *
+ * The timing thread fills chunks and advances head, the writer thread
+ * encodes them and advances tail.
+ * Each index is written by only one thread, so the ring needs no locks.
+ */
+typedef struct trace_stct {
+/*! Ring of TRACE_CHUNKS chunks, plus a spare to spill into when the ring is full */
+	trace_chunk_t *ring;
+/*! Next free slot in the chunk being filled, or NULL if not tracing */
+	uint64_t *pos;
+/*! End of the chunk being filled */
+	uint64_t *end;
+/*! Chunks published by the timing thread */
+	uint64_t head;
+/*! Chunks written by the writer thread */
+	uint64_t tail;
+/*! Set when the timing thread has published its last chunk */
+	int done;
+/*! Deltas dropped since the last published chunk */
+	uint64_t dropped;
+/*! First write error seen by the writer thread, or 0 */
+	int error;
+/*! Bytes written to the trace file */
+	uint64_t bytes;
+/*! Trace file header, counts updated by the writer thread */
+	trace_hdr_t hdr;
+/*! Trace file */
+	FILE *fp;
+/*! Writer thread */
+	pthread_t writer;
+} trace_t;
+
+/*! State of trace capture */
+trace_t trace;
+
+/*!
+ * \brief Append an unsigned LEB128 varint
+ * \param p Where to write, with room for 10 bytes
+ * \param v Value to write
+ * \return Pointer just past the varint
+ */
+static inline uint8_t *
+varint_put(uint8_t *p, uint64_t v) {
+	while (v >= 0x80) {
+		*p++ = (uint8_t)v | 0x80;
+		v >>= 7;
+	}
+	*p++ = (uint8_t)v;
+	return (p);
+}
+
+/*!
+ * \brief Read an unsigned LEB128 varint
+ * \param pp  Pointer to read pointer, advanced past the varint
+ * \param end End of buffer
+ * \param v   Value read
+ * \return 0 if read, -1 if the buffer ended first
+ */
+int
+varint_get(const uint8_t **pp, const uint8_t *end, uint64_t *v) {
+	const uint8_t *p;
+	int shift = 0;
+
+	*v = 0;
+	for (p=*pp; p<end && shift<64; shift+=7) {
+		*v |= (uint64_t)(*p & 0x7f) << shift;
+		if ((*p++ & 0x80) == 0) {
+			*pp = p;
+			return (0);
+		}
+	}
+	return (-1);
+}
+
+/*!
+ * \brief Compute Huffman code lengths no longer than TRACE_CODE_MAX
+ * \param freq Frequency of each of 256 symbols
+ * \param len  Code length of each symbol, 0 if unused
+ *
+ * Frequencies are flattened and the tree built again until no code is
+ * too long, which rarely takes more than one try.
+ */
+void
+huff_lengths(const uint64_t *freq, uint8_t *len) {
+	uint64_t f[256], w[511];
+	int parent[511], live[511];
+	int i, a, b, next, nlive, depth, maxlen;
+
+	memcpy(f, freq, sizeof(f));
+	for (;;) {
+		for (i=0, nlive=0; i<256; i++) {
+			w[i] = f[i];
+			live[i] = (f[i] != 0);
+			parent[i] = -1;
+			len[i] = 0;
+			nlive += live[i];
+		}
+		if (nlive <= 1) {
+			/* A lone symbol still needs a one-bit code */
+			for (i=0; i<256; i++)
+				len[i] = live[i];
+			return;
+		}
+
+		/* Repeatedly merge the two lightest live nodes */
+		for (next=256; nlive>1; next++, nlive--) {
+			for (i=0, a=b=-1; i<next; i++) {
+				if (!live[i])
+					continue;
+				if (a<0 || w[i]<w[a]) {
+					b = a;
+					a = i;
+				} else if (b<0 || w[i]<w[b]) {
+					b = i;
+				}
+			}
+			w[next] = w[a]+w[b];
+			live[next] = 1;
+			parent[next] = -1;
+			live[a] = live[b] = 0;
+			parent[a] = parent[b] = next;
+		}
+
+		for (i=0, maxlen=0; i<256; i++) {
+			if (f[i] == 0)
+				continue;
+			for (depth=0, a=i; parent[a]>=0; a=parent[a])
+				depth++;
+			len[i] = depth;
+			if (depth > maxlen)
+				maxlen = depth;
+		}
+		if (maxlen <= TRACE_CODE_MAX)
+			return;
+		for (i=0; i<256; i++) {
+			if (f[i] != 0)
+				f[i] = (f[i]>>1) | 1;
+		}
+	}
+}
+
+/*!
+ * \brief Encode one chunk of deltas as a trace record
+ * \param cp   Chunk to encode
+ * \param out  Buffer for the record, at least 12 bytes per delta plus 256
+ * \param side Scratch for the side stream, at least 10 bytes per delta
+ * \param syms Scratch for symbols, at least 1 byte per delta
+ * \return Length of record (bytes)
+ *
+ * Deltas below TRACE_SYM_ESC are their own symbol.
+ * Larger deltas are escaped with their value in a side stream of varints,
+ * and runs repeating the previous delta become one symbol with the run
+ * length in the side stream.
+ * Symbols are Huffman coded with canonical codes built for the chunk, so
+ * the few delta values that dominate a quiet system take a bit or two.
+ *
+ * A record is: varint delta count, varint count dropped before the chunk,
+ * 128 bytes of 4-bit code lengths, varint side stream length, side stream,
+ * varint code bytes, and MSB-first codes.
+ */
+size_t
+trace_encode(const trace_chunk_t *cp, uint8_t *out, uint8_t *side, uint8_t *syms) {
+	uint64_t freq[256], nbits, acc = 0, prev = 0, i, j;
+	uint16_t code[256], next[TRACE_CODE_MAX+1];
+	uint8_t len[256], *op = out, *sp = side, *sym = syms, *s;
+	int count[TRACE_CODE_MAX+1], l, nacc = 0;
+
+	/* Turn deltas into symbols and the side stream */
+	memset(freq, 0, sizeof(freq));
+	for (i=0; i<cp->n; ) {
+		if (i > 0) {
+			for (j=i; j<cp->n && cp->deltas[j]==prev; j++) {}
+			if (j-i >= TRACE_RUN_MIN) {
+				*sym = TRACE_SYM_RUN;
+				sp = varint_put(sp, j-i);
+				freq[*sym++]++;
+				i = j;
+				continue;
+			}
+		}
+		prev = cp->deltas[i++];
+		if (prev < TRACE_SYM_ESC) {
+			*sym = (uint8_t)prev;
+		} else {
+			*sym = TRACE_SYM_ESC;
+			sp = varint_put(sp, prev);
+		}
+		freq[*sym++]++;
+	}
+
+	/* Canonical codes: shorter codes first, then in symbol order */
+	huff_lengths(freq, len);
+	memset(count, 0, sizeof(count));
+	for (i=0; i<256; i++)
+		count[len[i]]++;
+	count[0] = 0;
+	next[0] = 0;
+	for (l=1; l<=TRACE_CODE_MAX; l++)
+		next[l] = (next[l-1]+count[l-1]) << 1;
+	for (i=0, nbits=0; i<256; i++) {
+		if (len[i] != 0)
+			code[i] = next[len[i]]++;
+		nbits += freq[i]*len[i];
+	}
+
+	op = varint_put(op, cp->n);
+	op = varint_put(op, cp->dropped);
+	for (i=0; i<256; i+=2)
+		*op++ = len[i] | len[i+1]<<4;
+	op = varint_put(op, sp-side);
+	memcpy(op, side, sp-side);
+	op += sp-side;
+	op = varint_put(op, (nbits+7)/8);
+	for (s=syms; s<sym; s++) {
+		acc = acc<<len[*s] | code[*s];
+		nacc += len[*s];
+		while (nacc >= 8) {
+			nacc -= 8;
+			*op++ = (uint8_t)(acc>>nacc);
+		}
+	}
+	if (nacc > 0)
+		*op++ = (uint8_t)(acc<<(8-nacc));
+	return (op-out);
+}
+
+/*!
+ * \brief Decode one trace record (see trace_encode())
+ * \param rec     Record without its length prefix
+ * \param rlen    Length of record (bytes)
+ * \param deltas  Buffer for up to TRACE_CHUNK_DELTAS deltas
+ * \param n       Number of deltas decoded
+ * \param dropped Number of deltas dropped just before the chunk
+ * \return 0 if decoded, -1 if the record is corrupt
+ */
+int
+trace_decode(const uint8_t *rec, size_t rlen, uint64_t *deltas,
+    uint64_t *n, uint64_t *dropped) {
+	const uint8_t *p = rec, *end = rec+rlen, *side, *side_end, *bits;
+	uint64_t slen, blen, nbits, bitpos = 0, i, v, prev = 0;
+	uint8_t len[256], sorted[256];
+	int count[TRACE_CODE_MAX+1], offs[TRACE_CODE_MAX+1];
+	int l, sym, code, first, index;
+
+	if (varint_get(&p, end, n) != 0 || varint_get(&p, end, dropped) != 0 ||
+	    *n > TRACE_CHUNK_DELTAS || end-p < 128)
+		return (-1);
+	for (i=0; i<256; i+=2, p++) {
+		len[i]   = *p & 0xf;
+		len[i+1] = *p >> 4;
+	}
+	if (varint_get(&p, end, &slen) != 0 || slen > (uint64_t)(end-p))
+		return (-1);
+	side = p;
+	side_end = p += slen;
+	if (varint_get(&p, end, &blen) != 0 || blen > (uint64_t)(end-p))
+		return (-1);
+	bits = p;
+	nbits = blen*8;
+
+	/* Symbols sorted by code length, then value, for canonical decoding */
+	memset(count, 0, sizeof(count));
+	for (i=0; i<256; i++)
+		count[len[i]]++;
+	count[0] = 0;
+	for (l=1, offs[1]=0; l<TRACE_CODE_MAX; l++)
+		offs[l+1] = offs[l]+count[l];
+	for (i=0; i<256; i++) {
+		if (len[i] != 0)
+			sorted[offs[len[i]]++] = (uint8_t)i;
+	}
+
+	for (i=0; i<*n; ) {
+		/* Walk down the code lengths one bit at a time */
+		for (l=1, code=first=index=0, sym=-1; l<=TRACE_CODE_MAX; l++) {
+			if (bitpos >= nbits)
+				return (-1);
+			code |= (bits[bitpos>>3] >> (7-(bitpos&7))) & 1;
+			bitpos++;
+			if (code-first < count[l]) {
+				sym = sorted[index+code-first];
+				break;
+			}
+			index += count[l];
+			first = (first+count[l]) << 1;
+			code <<= 1;
+		}
+		if (sym < 0)
+			return (-1);
+		if (sym == TRACE_SYM_RUN) {
+			if (i == 0 || varint_get(&side, side_end, &v) != 0 || v > *n-i)
+				return (-1);
+			while (v-- > 0)
+				deltas[i++] = prev;
+			continue;
+		}
+		if (sym == TRACE_SYM_ESC) {
+			if (varint_get(&side, side_end, &v) != 0)
+				return (-1);
+		} else {
+			v = sym;
+		}
+		deltas[i++] = prev = v;
+	}
+	return (0);
+}
+
+/*!
+ * \brief Trace writer thread: encode published chunks and write them out
+ * \param arg Unused
+ * \return NULL
+ */
+void *
+trace_writer(void *arg) {
+	uint8_t *out, *side, *syms, lenbuf[10];
+	size_t len, hlen;
+	trace_chunk_t *cp;
+
+	(void)arg;
+	helper_setup();
+	out  = malloc(12*TRACE_CHUNK_DELTAS+256);
+	side = malloc(10*TRACE_CHUNK_DELTAS);
+	syms = malloc(TRACE_CHUNK_DELTAS);
+	if (out==NULL || side==NULL || syms==NULL) {
+		fprintf(stderr, "Couldn't allocate memory for trace encoding\n");
+		exit(1);
+	}
+
+	for (;;) {
+		if (trace.tail == __atomic_load_n(&trace.head, __ATOMIC_ACQUIRE)) {
+			/* Done is set after the last head, so check head again */
+			if (__atomic_load_n(&trace.done, __ATOMIC_ACQUIRE) &&
+			    trace.tail == __atomic_load_n(&trace.head, __ATOMIC_ACQUIRE))
+				break;
+			SLEEP_MSEC(TRACE_POLL_MS);
+			continue;
+		}
+		cp = &trace.ring[trace.tail % TRACE_CHUNKS];
+		len = trace_encode(cp, out, side, syms);
+		hlen = varint_put(lenbuf, len) - lenbuf;
+		if (trace.error == 0 && (fwrite(lenbuf, 1, hlen, trace.fp) != hlen ||
+		    fwrite(out, 1, len, trace.fp) != len))
+			trace.error = errno;
+		trace.bytes += hlen+len;
+		trace.hdr.deltas  += cp->n;
+		trace.hdr.dropped += cp->dropped;
+		trace.hdr.chunks++;
+		__atomic_store_n(&trace.tail, trace.tail+1, __ATOMIC_RELEASE);
+	}
+	free(out);
+	free(side);
+	free(syms);
+	return (NULL);
+}
+
+/*!
+ * \brief Create the trace file, allocate the chunk ring, and start the writer thread
+ */
+void
+trace_setup() {
+	if ((trace.fp=fopen(args.trace, "wb")) == NULL) {
+		fprintf(stderr, "Unable to create trace file %s\n", args.trace);
+		perror(args.trace);
+		exit(1);
+	}
+	strncpy(trace.hdr.magic, TRACE_MAGIC, sizeof(trace.hdr.magic));
+	trace.hdr.version = TRACE_VERSION;
+	trace.hdr.hdr_size = sizeof(trace.hdr);
+	trace.hdr.knee = args.knee;
+	/* Header is written again with counts when the run ends */
+	if (fwrite(&trace.hdr, sizeof(trace.hdr), 1, trace.fp) != 1) {
+		perror(args.trace);
+		exit(1);
+	}
+	trace.bytes = sizeof(trace.hdr);
+
+	if ((trace.ring=(trace_chunk_t *)buf_alloc(
+	    sizeof(trace_chunk_t)*(TRACE_CHUNKS+1), "Trace buffer")) == NULL) {
+		fprintf(stderr, "Couldn't allocate memory for trace buffer\n");
+		exit(1);
+	}
+	trace.pos = trace.ring[0].deltas;
+	trace.end = trace.pos+TRACE_CHUNK_DELTAS;
+
+	if (pthread_create(&trace.writer, NULL, trace_writer, NULL) != 0) {
+		fprintf(stderr, "Couldn't start trace writer thread\n");
+		exit(1);
+	}
+}
+
+/*!
+ * \brief Hand the full chunk to the writer thread and start filling another
+ *
+ * Called by the timing thread, so it never waits.
+ * If the writer has fallen behind and the ring is full, the next chunk
+ * spills into the spare and is counted as dropped instead of written.
+ */
+void
+trace_publish() {
+	trace_chunk_t *spill = &trace.ring[TRACE_CHUNKS], *cp;
+	uint64_t n = trace.pos - (trace.end-TRACE_CHUNK_DELTAS);
+
+	if (trace.end == spill->deltas+TRACE_CHUNK_DELTAS) {
+		trace.dropped += n;
+	} else {
+		cp = &trace.ring[trace.head % TRACE_CHUNKS];
+		cp->n = n;
+		cp->dropped = trace.dropped;
+		trace.dropped = 0;
+		__atomic_store_n(&trace.head, trace.head+1, __ATOMIC_RELEASE);
+	}
+
+	if (trace.head-__atomic_load_n(&trace.tail, __ATOMIC_ACQUIRE) < TRACE_CHUNKS)
+		cp = &trace.ring[trace.head % TRACE_CHUNKS];
+	else
+		cp = spill;
+	trace.pos = cp->deltas;
+	trace.end = cp->deltas+TRACE_CHUNK_DELTAS;
+}
+
+/*!
+ * \brief Publish the last partial chunk, wait for the writer, and report on the trace
+ * \param tpns Ticks per nanosecond measured over the run
+ */
+void
+trace_finish(double tpns) {
+	trace_chunk_t *spill = &trace.ring[TRACE_CHUNKS], *cp;
+	uint64_t n = trace.pos - (trace.end-TRACE_CHUNK_DELTAS);
+
+	/* Timing is over, so wait for room rather than lose the drop count */
+	if (trace.end == spill->deltas+TRACE_CHUNK_DELTAS) {
+		trace.dropped += n;
+		n = 0;
+		while (trace.head-__atomic_load_n(&trace.tail, __ATOMIC_ACQUIRE) >= TRACE_CHUNKS)
+			SLEEP_MSEC(TRACE_POLL_MS);
+	}
+	if (n>0 || trace.dropped>0) {
+		cp = &trace.ring[trace.head % TRACE_CHUNKS];
+		cp->n = n;
+		cp->dropped = trace.dropped;
+		__atomic_store_n(&trace.head, trace.head+1, __ATOMIC_RELEASE);
+	}
+	trace.pos = NULL;
+	__atomic_store_n(&trace.done, 1, __ATOMIC_RELEASE);
+	pthread_join(trace.writer, NULL);
+
+	trace.hdr.tpns = tpns;
+	if (trace.error == 0 && (fseek(trace.fp, 0, SEEK_SET) != 0 ||
+	    fwrite(&trace.hdr, sizeof(trace.hdr), 1, trace.fp) != 1))
+		trace.error = errno;
+	if (fclose(trace.fp) != 0 && trace.error == 0)
+		trace.error = errno;
+
+	if (trace.error != 0) {
+		printf("Trace file              : %s failed, %s\n", args.trace,
+		    strerror(trace.error));
+		return;
+	}
+	printf("Trace file              : %s, %" PRIu64 " deltas in %" PRIu64
+	    " bytes, %.2f bits per delta\n", args.trace, trace.hdr.deltas,
+	    trace.bytes, trace.hdr.deltas ? 8.0*trace.bytes/trace.hdr.deltas : 0.0);
+	if (trace.hdr.dropped != 0) {
+		printf("Trace deltas dropped    : %" PRIu64 " (%.2f%%) while the writer fell behind\n",
+		    trace.hdr.dropped,
+		    100.0*trace.hdr.dropped/(trace.hdr.deltas+trace.hdr.dropped));
+	}
+}
+
+/*!
+ * \brief Open a trace file and read its header
+ * \param path Name of trace file
+ * \param hp   Header read from file
+ * \return File positioned at the first record, or NULL if it isn't a usable trace
+ */
+FILE *
+trace_open(const char *path, trace_hdr_t *hp) {
+	FILE *fp;
+
+	if ((fp=fopen(path, "rb")) == NULL) {
+		perror(path);
+		return (NULL);
+	}
+	if (fread(hp, sizeof(*hp), 1, fp) != 1 ||
+	    strncmp(hp->magic, TRACE_MAGIC, sizeof(hp->magic)) != 0) {
+		fprintf(stderr, "%s is not a trace file\n", path);
+		fclose(fp);
+		return (NULL);
+	}
+	if (hp->version != TRACE_VERSION || fseek(fp, hp->hdr_size, SEEK_SET) != 0) {
+		fprintf(stderr, "%s is trace version %u, expected %u\n", path,
+		    hp->version, TRACE_VERSION);
+		fclose(fp);
+		return (NULL);
+	}
+	return (fp);
+}
+
+/*!
+ * \brief Read and decode the next record of a trace file
+ * \param fp      Trace file from trace_open()
+ * \param deltas  Buffer for up to TRACE_CHUNK_DELTAS deltas
+ * \param n       Number of deltas read
+ * \param dropped Number of deltas dropped just before them
+ * \return 1 if a record was read, 0 at end of file, -1 if the trace is corrupt
+ */
+int
+trace_read(FILE *fp, uint64_t *deltas, uint64_t *n, uint64_t *dropped) {
+	uint64_t rlen = 0;
+	uint8_t *rec;
+	int c, shift, rc;
+
+	for (shift=0; (c=getc(fp)) != EOF; shift+=7) {
+		if (shift >= 64)
+			return (-1);
+		rlen |= (uint64_t)(c & 0x7f) << shift;
+		if ((c & 0x80) == 0)
+			break;
+	}
+	if (c == EOF)
+		return ((shift == 0) ? 0 : -1);
+	if (rlen > 12*TRACE_CHUNK_DELTAS+256 || (rec=malloc(rlen)) == NULL)
+		return (-1);
+	rc = (fread(rec, 1, rlen, fp) == rlen &&
+	    trace_decode(rec, rlen, deltas, n, dropped) == 0) ? 1 : -1;
+	free(rec);
+	return (rc);
+}
+
+/*!
+ * \brief Print every delta in a trace file, one per line
+ * \param path Name of trace file
+ * \return 0 if the whole trace was printed, 1 otherwise
+ */
+int
+dump_trace(const char *path) {
+	trace_hdr_t hdr;
+	uint64_t *deltas, n, dropped, i;
+	FILE *fp;
+	int rc;
+
+	if ((fp=trace_open(path, &hdr)) == NULL)
+		return (1);
+	if ((deltas=malloc(sizeof(uint64_t)*TRACE_CHUNK_DELTAS)) == NULL) {
+		fprintf(stderr, "Couldn't allocate memory for trace\n");
+		return (1);
+	}
+	printf("# %s: %" PRIu64 " deltas, %" PRIu64 " dropped, %f ticks per ns, knee %"
+	    PRIu64 " ticks, %d deltas per block\n", path, hdr.deltas, hdr.dropped,
+	    hdr.tpns, hdr.knee, BLOCK_DELTAS);
+	while ((rc=trace_read(fp, deltas, &n, &dropped)) > 0) {
+		if (dropped != 0)
+			printf("# %" PRIu64 " deltas dropped\n", dropped);
+		for (i=0; i<n; i++)
+			printf("%" PRIu64 "\n", deltas[i]);
+	}
+	fclose(fp);
+	free(deltas);
+	if (rc < 0) {
+		fprintf(stderr, "%s: corrupt trace record\n", path);
+		return (1);
+	}
+	return (0);
+}
+#endif	/* _WIN32 */
+
+#ifndef _WIN32
+/*! Flight RECord slot states */
+enum fr_states {
+	FR_FREE,		/*!< Slot is free for a new trigger */
+	FR_FILLING,		/*!< Triggered, waiting for deltas after the trigger */
+	FR_DONE,		/*!< All deltas saved, waiting to be written */
+};
+
+/*! Files the Flight Recorder snapshots around each trigger */
+const char *fr_files[] = {"/proc/interrupts", "/proc/self/schedstat", "/proc/stat"};
+
+/*! Type for one flight record: deltas around a trigger and system snapshots */
+typedef struct fr_rec_stct {
+/*! State of slot, one of fr_states */
+	int state;
+/*! CPU the timing thread was on at the trigger, or -1 if unknown */
+	int cpu;
+/*! Position of the triggering delta in its block */
+	int pos;
+/*! TSC at the start of the triggering delta */
+	uint64_t when;
+/*! Size of triggering delta (ticks) */
+	uint64_t delta;
+/*! Index of the triggering delta since the start of the run */
+	uint64_t trig;
+/*! Index of deltas[0] since the start of the run, always at the start of a block */
+	uint64_t first;
+/*! Number of deltas saved */
+	uint64_t n;
+/*! Deltas around the trigger */
+	uint64_t *deltas;
+/*! True once the helper thread has taken snapshots for this record */
+	int snapped;
+/*! TSC when the before and after snapshots were taken */
+	uint64_t before_tsc, after_tsc;
+/*! Contents of fr_files before and after the trigger, NULL if unreadable */
+	char *before[ARRAY_SIZE(fr_files)], *after[ARRAY_SIZE(fr_files)];
+} fr_rec_t;
+
+/*!
+ * \brief Type for the state of the flight recorder
+ *
+ * The timing thread copies every block of deltas into a ring.
+ * When a delta exceeds the trigger, it claims a free record slot and
+ * fills it with deltas from the ring once enough deltas after the trigger
+ * have been taken.
+ * A helper thread keeps recent snapshots of fr_files, takes new ones when
+ * it sees a trigger, and writes finished records.
+ */
+typedef struct fr_stct {
+/*! Ring of recent deltas, a whole number of blocks, or NULL if not recording */
+	uint64_t *ring;
+/*! Next block in ring to fill */
+	uint64_t *wp;
+/*! Length of ring (deltas) */
+	uint64_t len;
+/*! Number of deltas copied into ring since the start of the run */
+	uint64_t count;
+/*! Record slots */
+	fr_rec_t rec[FR_SLOTS];
+/*! Record waiting for deltas after its trigger, or NULL */
+	fr_rec_t *filling;
+/*! Count at which the filling record has all its deltas */
+	uint64_t until;
+/*! Number of triggers, including those skipped */
+	uint64_t triggers;
+/*! Number of triggers skipped because every slot was busy */
+	uint64_t skipped;
+/*! Number of records written */
+	uint64_t written;
+/*! TSC at the start of the run, set by the timing thread before it starts */
+	uint64_t start_tsc;
+/*! Ticks per nanosecond calibrated before the run for record times */
+	double tpns;
+/*! Set by the helper once it has taken its first snapshot */
+	int ready;
+/*! Set when the timing thread is done with all slots */
+	int done;
+/*! Flight record file */
+	FILE *fp;
+/*! Helper thread */
+	pthread_t helper;
+} fr_t;
+
+/*! State of the flight recorder */
+fr_t fr;
+
+/*!
+ * \brief Take a snapshot of each of fr_files
+ * \param text Receives the malloc()'d contents of each file, or NULL if unreadable
+ * \param tsc  Receives TSC when the snapshot was taken
+ */
+void
+fr_snap(char **text, uint64_t *tsc) {
+	size_t i;
+
+	rdtsc(*tsc);
+	for (i=0; i<ARRAY_SIZE(fr_files); i++)
+		text[i] = file_read(fr_files[i]);
+}
+
+/*!
+ * \brief Find the count for one interrupt on one CPU in a line of /proc/interrupts
+ * \param text  Contents of /proc/interrupts
+ * \param label Interrupt label to find, like "LOC" or "24"
+ * \param col   Column of the CPU wanted
+ * \param count Receives the count
+ * \return Description at the end of the line, or NULL if not found
+ */
+const char *
+irq_count(const char *text, const char *label, int col, uint64_t *count) {
+	const char *p, *colon;
+	char *end;
+	size_t llen = strlen(label);
+	int i;
+
+	for (p=strchr(text, '\n'); p!=NULL; p=strchr(p, '\n')) {
+		for (p++; *p==' '; p++) {}
+		if ((colon=strchr(p, ':')) == NULL)
+			break;
+		if ((size_t)(colon-p) != llen || strncmp(p, label, llen) != 0)
+			continue;
+		for (i=0, p=colon+1; i<=col; i++, p=end) {
+			*count = strtoull(p, &end, 10);
+			if (end == p)
+				return (NULL);
+		}
+		/* Skip the other CPUs' counts to reach the description */
+		while (*p==' ' || (*p>='0' && *p<='9'))
+			p++;
+		return (p);
+	}
+	return (NULL);
+}
+
+/*!
+ * \brief Write interrupts taken on a CPU between two /proc/interrupts snapshots
+ * \param fp     Flight record file
+ * \param before Contents of /proc/interrupts before
+ * \param after  Contents of /proc/interrupts after
+ * \param cpu    CPU wanted
+ */
+void
+fr_write_irqs(FILE *fp, const char *before, const char *after, int cpu) {
+	char name[32], label[32];
+	const char *p, *colon, *desc;
+	uint64_t b, a;
+	int col = -1, n, found = 0;
+
+	/* Header line names the CPU of each column */
+	snprintf(name, sizeof(name), "CPU%d", cpu);
+	for (p=after, n=0; *p!='\n' && *p!='\0'; n++) {
+		while (*p == ' ')
+			p++;
+		if (strncmp(p, name, strlen(name)) == 0 &&
+		    (p[strlen(name)] == ' ' || p[strlen(name)] == '\n'))
+			col = n;
+		while (*p!=' ' && *p!='\n' && *p!='\0')
+			p++;
+	}
+	if (col < 0) {
+		fprintf(fp, "Interrupts              : CPU %d not found\n", cpu);
+		return;
+	}
+
+	for (p=strchr(after, '\n'); p!=NULL; p=strchr(p, '\n')) {
+		for (p++; *p==' '; p++) {}
+		if ((colon=strchr(p, ':')) == NULL || colon-p >= (int)sizeof(label))
+			break;
+		memcpy(label, p, colon-p);
+		label[colon-p] = '\0';
+		if ((desc=irq_count(after, label, col, &a)) == NULL ||
+		    irq_count(before, label, col, &b) == NULL || a == b)
+			continue;
+		fprintf(fp, "Interrupts on CPU %-5d : %-6s +%-8" PRIu64 " %.*s\n", cpu,
+		    label, a-b, (int)strcspn(desc, "\n"), desc);
+		found++;
+	}
+	if (!found)
+		fprintf(fp, "Interrupts on CPU %-5d : none\n", cpu);
+}
+
+/*!
+ * \brief Write one flight record
+ * \param rp   Record to write
+ * \param tpns Ticks per nanosecond
+ */
+void
+fr_write(const fr_rec_t *rp, double tpns) {
+	FILE *fp = fr.fp;
+	uint64_t i, v[16];
+	char name[32];
+	const char *b, *a;
+	int nb, na, j;
+
+	fprintf(fp, "Flight record %" PRIu64 ": %" PRIu64 " tick (%s) delta at %f ms"
+	    ", position %d in block, CPU %d\n", ++fr.written, rp->delta,
+	    t2ts(rp->delta, tpns), (rp->when-fr.start_tsc)/tpns/1000000.0,
+	    rp->pos, rp->cpu);
+
+	fprintf(fp, "Deltas (ticks), one block per line, trigger marked with *:\n");
+	for (i=0; i<rp->n; i++) {
+		fprintf(fp, "%8" PRIu64 "%c", rp->deltas[i],
+		    (rp->first+i == rp->trig) ? '*' : ' ');
+		if ((i+1)%BLOCK_DELTAS == 0 || i+1 == rp->n)
+			fprintf(fp, "\n");
+	}
+
+	if (!rp->snapped) {
+		fprintf(fp, "Snapshots               : none taken\n\n");
+		return;
+	}
+	if (rp->before_tsc > rp->when) {
+		fprintf(fp, "Snapshots               : both taken after the trigger\n\n");
+		return;
+	}
+	fprintf(fp, "Snapshots               : %s before and %s after the trigger\n",
+	    t2ts(rp->when-rp->before_tsc, tpns), t2ts(rp->after_tsc-rp->when, tpns));
+
+	/* Interrupts */
+	if (rp->before[0]!=NULL && rp->after[0]!=NULL && rp->cpu>=0)
+		fr_write_irqs(fp, rp->before[0], rp->after[0], rp->cpu);
+
+	/* Run time, wait time, and timeslices of the timing thread */
+	if (rp->before[1]!=NULL && rp->after[1]!=NULL &&
+	    sscanf(rp->before[1], "%" SCNu64 " %" SCNu64 " %" SCNu64, &v[0], &v[1], &v[2]) == 3 &&
+	    sscanf(rp->after[1],  "%" SCNu64 " %" SCNu64 " %" SCNu64, &v[3], &v[4], &v[5]) == 3) {
+		fprintf(fp, "Timing thread schedstat : +%" PRIu64 "ns run, +%" PRIu64
+		    "ns waiting, +%" PRIu64 " timeslices\n", v[3]-v[0], v[4]-v[1], v[5]-v[2]);
+	}
+
+	/* CPU time of the measured CPU by category */
+	snprintf(name, sizeof(name), "\ncpu%d ", rp->cpu);
+	if (rp->before[2]!=NULL && rp->after[2]!=NULL && rp->cpu>=0 &&
+	    (b=strstr(rp->before[2], name)) != NULL && (a=strstr(rp->after[2], name)) != NULL) {
+		static const char *cat[] = {"user", "nice", "system", "idle",
+		    "iowait", "irq", "softirq", "steal"};
+		nb = sscanf(b+strlen(name), "%" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64
+		    " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64,
+		    &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]);
+		na = sscanf(a+strlen(name), "%" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64
+		    " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64,
+		    &v[8], &v[9], &v[10], &v[11], &v[12], &v[13], &v[14], &v[15]);
+		fprintf(fp, "CPU %-3d time (USER_HZ)  :", rp->cpu);
+		for (j=0; j<nb && j<na; j++)
+			fprintf(fp, " %s +%" PRIu64, cat[j], v[8+j]-v[j]);
+		fprintf(fp, "\n");
+	}
+	fprintf(fp, "\n");
+	fflush(fp);
+}
+
+/*!
+ * \brief Flight recorder helper thread: snapshot fr_files and write records
+ * \param arg Unused
+ * \return NULL
+ *
+ * Snapshots are refreshed about every FR_SNAP_MS so the one taken before
+ * a trigger is recent, and a new one is taken as soon as a trigger is seen.
+ */
+void *
+fr_helper(void *arg) {
+	char *before[ARRAY_SIZE(fr_files)];
+	uint64_t before_tsc;
+	fr_rec_t *rp;
+	size_t i;
+	int busy, polls = 0;
+
+	(void)arg;
+	helper_setup();
+	fr_snap(before, &before_tsc);
+	__atomic_store_n(&fr.ready, 1, __ATOMIC_RELEASE);
+
+	for (;;) {
+		int done = __atomic_load_n(&fr.done, __ATOMIC_ACQUIRE);
+
+		for (rp=fr.rec, busy=0; rp<fr.rec+FR_SLOTS; rp++) {
+			int state = __atomic_load_n(&rp->state, __ATOMIC_ACQUIRE);
+
+			if (state == FR_FREE)
+				continue;
+			busy++;
+			if (!rp->snapped) {
+				/* The latest periodic snapshot becomes this record's before */
+				memcpy(rp->before, before, sizeof(before));
+				rp->before_tsc = before_tsc;
+				fr_snap(rp->after, &rp->after_tsc);
+				rp->snapped = 1;
+				fr_snap(before, &before_tsc);
+				polls = 0;
+			}
+			if (state == FR_DONE) {
+				/* Calibrated before timing, so before any trigger */
+				fr_write(rp, fr.tpns);
+				for (i=0; i<ARRAY_SIZE(fr_files); i++) {
+					free(rp->before[i]);
+					free(rp->after[i]);
+				}
+				rp->snapped = 0;
+				__atomic_store_n(&rp->state, FR_FREE, __ATOMIC_RELEASE);
+			}
+		}
+		if (done && busy == 0)
+			break;
+
+		if (++polls >= FR_SNAP_MS) {
+			for (i=0; i<ARRAY_SIZE(fr_files); i++)
+				free(before[i]);
+			fr_snap(before, &before_tsc);
+			polls = 0;
+		}
+		SLEEP_MSEC(1);
+	}
+	for (i=0; i<ARRAY_SIZE(fr_files); i++)
+		free(before[i]);
+	return (NULL);
+}
+
+/*!
+ * \brief Allocate the delta ring and record slots, create the record file, and start the helper
+ * \param tpns Ticks per nanosecond calibrated before the run
+ */
+void
+fr_setup(double tpns) {
+	/* Ring holds context before and after plus a block of slack on each side */
+	uint64_t rlen = (2*args.context/BLOCK_DELTAS+4)*BLOCK_DELTAS;
+	uint64_t *buf;
+	int i;
+
+	if ((fr.fp=fopen(args.record, "w")) == NULL) {
+		fprintf(stderr, "Unable to create flight record file %s\n", args.record);
+		perror(args.record);
+		exit(1);
+	}
+	if ((buf=(uint64_t *)buf_alloc(sizeof(uint64_t)*rlen*(FR_SLOTS+1),
+	    "Flight recorder buffer")) == NULL) {
+		fprintf(stderr, "Couldn't allocate memory for flight recorder\n");
+		exit(1);
+	}
+	fr.ring = fr.wp = buf;
+	fr.len = rlen;
+	for (i=0; i<FR_SLOTS; i++)
+		fr.rec[i].deltas = buf+rlen*(i+1);
+	fr.tpns = tpns;
+
+	if (pthread_create(&fr.helper, NULL, fr_helper, NULL) != 0) {
+		fprintf(stderr, "Couldn't start flight recorder thread\n");
+		exit(1);
+	}
+	/* Let the helper take its first snapshot before timing starts */
+	while (!__atomic_load_n(&fr.ready, __ATOMIC_ACQUIRE))
+		SLEEP_MSEC(1);
+}
+
+/*!
+ * \brief Claim a record slot for a delta above the trigger
+ * \param when  TSC at the start of the delta
+ * \param delta Size of delta (ticks)
+ * \param pos   Position of the delta in the block just copied into the ring
+ */
+void
+fr_trigger(uint64_t when, uint64_t delta, int pos) {
+	fr_rec_t *rp;
+	uint64_t start;
+
+	fr.triggers++;
+	/* A trigger while filling is already in that record */
+	if (fr.filling != NULL)
+		return;
+	for (rp=fr.rec; rp<fr.rec+FR_SLOTS; rp++) {
+		if (__atomic_load_n(&rp->state, __ATOMIC_ACQUIRE) == FR_FREE)
+			break;
+	}
+	if (rp == fr.rec+FR_SLOTS) {
+		fr.skipped++;
+		return;
+	}
+	rp->when  = when;
+	rp->delta = delta;
+	rp->pos   = pos;
+#ifdef	__linux__
+	rp->cpu   = sched_getcpu();
+#else	/* __linux__ */
+	rp->cpu   = -1;
+#endif	/* __linux__ */
+	rp->trig  = fr.count-BLOCK_DELTAS+pos;
+	/* Whole blocks from context before to context after */
+	start = (rp->trig > args.context) ? rp->trig-args.context : 0;
+	if (fr.count > fr.len-BLOCK_DELTAS && start < fr.count-(fr.len-BLOCK_DELTAS))
+		start = fr.count-(fr.len-BLOCK_DELTAS);
+	rp->first = start - start%BLOCK_DELTAS;
+	fr.until = (rp->trig+args.context)/BLOCK_DELTAS*BLOCK_DELTAS+BLOCK_DELTAS;
+	fr.filling = rp;
+	__atomic_store_n(&rp->state, FR_FILLING, __ATOMIC_RELEASE);
+}
+
+/*!
+ * \brief Copy deltas around the trigger out of the ring and hand the record to the helper
+ *
+ * Runs between blocks once the ring holds enough deltas after the trigger,
+ * or at the end of the run with whatever it has.
+ */
+void
+fr_complete() {
+	fr_rec_t *rp = fr.filling;
+	uint64_t i, end = (fr.until < fr.count) ? fr.until : fr.count;
+
+	for (i=rp->first; i<end; i++)
+		rp->deltas[i-rp->first] = fr.ring[i%fr.len];
+	rp->n = end-rp->first;
+	fr.filling = NULL;
+	__atomic_store_n(&rp->state, FR_DONE, __ATOMIC_RELEASE);
+}
+
+/*! \brief Finish any filling record, wait for the helper to write everything, and report */
+void
+fr_finish() {
+	if (fr.filling != NULL)
+		fr_complete();
+	__atomic_store_n(&fr.done, 1, __ATOMIC_RELEASE);
+	pthread_join(fr.helper, NULL);
+	fclose(fr.fp);
+
+	printf("Flight recorder         : %" PRIu64 " deltas above %" PRIu64
+	    " ticks, %" PRIu64 " records written to %s", fr.triggers, args.trigger,
+	    fr.written, args.record);
+	if (fr.skipped != 0)
+		printf(", %" PRIu64 " skipped while busy", fr.skipped);
+	printf("\n");
+}
+#endif	/* _WIN32 */
+
+#ifndef _WIN32
+/*!
+ * \brief Type for the state of the live display
+ *
+ * The render thread reads the histogram while the timing thread updates
+ * it, so a frame may mix counts from adjacent blocks, which doesn't
+ * matter for a display.
+ */
+typedef struct live_stct {
+/*! Largest outlier this interval, taken and zeroed by the render thread */
+	uint64_t max;
+/*! Statistics being updated by the timing thread */
+	const stats_t *stats;
+/*! Ticks per nanosecond calibrated before the run */
+	double tpns;
+/*! Set when the timing thread is done */
+	int done;
+/*! Render thread */
+	pthread_t render;
+} live_t;
+
+/*! State of the live display */
+live_t live;
+
+/*!
+ * \brief Render thread: redraw the histogram and interval statistics every LIVE_MS
+ * \param arg Unused
+ * \return NULL
+ */
+void *
+live_render(void *arg) {
+	bin_t *snap, *prev, *diff, *tmp;
+	ebin_t *ebp;
+	uint64_t i, events_now, events_prev = 0, imax, interval = 0, now, last;
+	results_t run, iv;
+	int ms;
+
+	(void)arg;
+	helper_setup();
+	snap = calloc(args.bins, sizeof(bin_t));
+	prev = calloc(args.bins, sizeof(bin_t));
+	diff = calloc(args.bins, sizeof(bin_t));
+	if (snap==NULL || prev==NULL || diff==NULL) {
+		fprintf(stderr, "Couldn't allocate memory for live display\n");
+		exit(1);
+	}
+
+	rdtsc(last);
+	while (!__atomic_load_n(&live.done, __ATOMIC_ACQUIRE)) {
+		/* Sleep in short steps so the end of the run isn't held up */
+		for (ms=0; ms<LIVE_MS && !__atomic_load_n(&live.done, __ATOMIC_ACQUIRE); ms+=100)
+			SLEEP_MSEC(100);
+
+		/* Snapshot the whole-run histogram and the interval's changes */
+		memset(&run, 0, sizeof(run));
+		memset(&iv, 0, sizeof(iv));
+		for (i=0; i<args.bins; i++) {
+			snap[i].ub = diff[i].ub = histo[i].ub;
+			snap[i].delta_count = __atomic_load_n(&histo[i].delta_count, __ATOMIC_RELAXED);
+			snap[i].delta_sum   = __atomic_load_n(&histo[i].delta_sum,   __ATOMIC_RELAXED);
+			diff[i].delta_count = snap[i].delta_count-prev[i].delta_count;
+			diff[i].delta_sum   = snap[i].delta_sum  -prev[i].delta_sum;
+			run.stats.count += snap[i].delta_count;
+			run.stats.sum   += snap[i].delta_sum;
+			iv.stats.count  += diff[i].delta_count;
+			if (diff[i].delta_count != 0)
+				iv.stats.max = (snap[i].ub < UINT64_MAX) ? snap[i].ub : 0;
+		}
+		imax = __atomic_exchange_n(&live.max, 0, __ATOMIC_RELAXED);
+		rdtsc(now);
+		iv.run_ticks = now-last;
+		last = now;
+		for (ebp=events.histo, events_now=0; ebp<events.histo+events.bins; ebp++)
+			events_now += __atomic_load_n(&ebp->events, __ATOMIC_RELAXED);
+		tmp = prev;
+		prev = snap;
+		snap = tmp;
+		if (run.stats.count == 0)
+			continue;
+
+		run.histo = prev;
+		run.bins = iv.bins = args.bins;
+		run.tpns = iv.tpns = live.tpns;
+		run.stats.min = iv.stats.min = __atomic_load_n(&live.stats->min, __ATOMIC_RELAXED);
+		iv.histo = diff;
+		/* Outliers give the exact max, else the top of the highest bin used */
+		if (imax != 0)
+			iv.stats.max = imax;
+
+		printf("\033[H\033[J");
+		histo_print(&run);
+		printf("\nInterval %" PRIu64 ": max %s, 99.9%% %s, stolen %s (%.4f%%), %"
+		    PRIu64 " interruptions\n", ++interval,
+		    t2ts(iv.stats.max, live.tpns), t2ts(histo_percentile(&iv, 99.9), live.tpns),
+		    t2ts(histo_stolen(&iv), live.tpns),
+		    100.0*histo_stolen(&iv)/iv.run_ticks, events_now-events_prev);
+		/* Windows are copied while the timing thread may close more */
+		for (i=0; rollup.ticks!=0 && i<ARRAY_SIZE(rollup.level); i++) {
+			window_t worst = rollup.level[i].worst;
+			if (__atomic_load_n(&rollup.level[i].n, __ATOMIC_ACQUIRE) != 0)
+				roll_print("Worst", rollup.level[i].name, &worst, rollup.start, live.tpns);
+		}
+		fflush(stdout);
+		events_prev = events_now;
+	}
+	free(snap);
+	free(prev);
+	free(diff);
+	return (NULL);
+}
+
+/*!
+ * \brief Start the live display
+ * \param sp   Statistics the timing thread will update
+ * \param tpns Ticks per nanosecond calibrated before the run
+ */
+void
+live_setup(const stats_t *sp, double tpns) {
+	live.stats = sp;
+	live.tpns = tpns;
+	if (pthread_create(&live.render, NULL, live_render, NULL) != 0) {
+		fprintf(stderr, "Couldn't start live display thread\n");
+		exit(1);
+	}
+}
+
+/*! \brief Stop the live display before the final report */
+void
+live_finish() {
+	__atomic_store_n(&live.done, 1, __ATOMIC_RELEASE);
+	pthread_join(live.render, NULL);
+	printf("\n");
+}
+#endif	/* _WIN32 */
+
+/*!
+ * \brief Type for the state of coordinated omission correction
+ *
+ * Samples a paced run would have taken during a stall are synthesized
+ * into histograms kept apart from the raw ones, so both can be reported.
+ */
+typedef struct co_stct {
+/*! Expected ticks between blocks, 0 if not correcting */
+	uint64_t ticks;
+/*! Synthesized deltas, with the same bins as histo */
+	bin_t *histo;
+/*! Statistics of synthesized deltas */
+	stats_t stats;
+/*! Synthesized block start lateness for missed deadlines, NULL without --interval */
+	bin_t *late;
+/*! Statistics of synthesized lateness */
+	stats_t late_stats;
+} co_t;
+
+/*! State of coordinated omission correction */
+co_t co;
+
+/*!
+ * \brief Allocate a histogram for synthesized samples with the bins of histo
+ * \return Histogram table
+ */
+bin_t *
+co_histo() {
+	bin_t *hp;
+	uint64_t i;
+
+	if ((hp=(bin_t *)buf_alloc(sizeof(bin_t)*args.bins,
+	    "Correction histogram")) == NULL) {
+		fprintf(stderr, "Couldn't allocate memory for correction histogram\n");
+		exit(1);
+	}
+	for (i=0; i<args.bins; i++)
+		hp[i].ub = histo[i].ub;
+	return (hp);
+}
+
+/*!
+ * \brief Set up coordinated omission correction
+ * \param ticks Expected ticks between blocks
+ */
+void
+co_setup(uint64_t ticks) {
+	co.ticks = (ticks != 0) ? ticks : 1;
+	co.histo = co_histo();
+	co.stats.min = UINT64_MAX;
+	co.late_stats.min = UINT64_MAX;
+	if (args.interval > 0)
+		co.late = co_histo();
+}
+
+/*!
+ * \brief Synthesize the samples a stall hid from a paced run
+ * \param delta Delta longer than the expected interval (ticks)
+ *
+ * A block started every interval would have found the stall still going
+ * and measured it shorter by one interval for each interval it lasted,
+ * down to one interval.
+ */
+void
+co_add(uint64_t delta) {
+	uint64_t n = delta/co.ticks;
+
+	if (n >= 2)
+		histo_add_seq(co.histo, &co.stats, delta-(n-1)*co.ticks, co.ticks, n-1);
+}
+
+/*!
+ * \brief Record how late blocks for missed deadlines would have started
+ * \param late  Lateness of the block that did start after its deadline (ticks)
+ * \param n     Number of later deadlines that passed before it started
+ * \param ticks Ticks between deadlines
+ *
+ * A block for each later deadline would have started with the one that
+ * did, so it is late by one interval less for each interval after.
+ */
+void
+co_missed(uint64_t late, uint64_t n, uint64_t ticks) {
+	histo_add_seq(co.late, &co.late_stats, late-n*ticks, ticks, n);
+}
+
+/*!
+ * \brief Print raw and corrected percentiles side by side
+ * \param what Name of the measurement, like "Delta"
+ * \param rp   Raw results
+ * \param hp   Histogram of synthesized samples
+ * \param sp   Statistics of synthesized samples
+ */
+void
+co_print(const char *what, const results_t *rp, const bin_t *hp, const stats_t *sp) {
+	static const double pcts[] = {99.0, 99.9, 99.99};
+	results_t cor = *rp;
+	char label[99];
+	uint64_t i;
+
+	if ((cor.histo=(bin_t *)malloc(sizeof(bin_t)*rp->bins)) == NULL) {
+		fprintf(stderr, "Couldn't allocate memory for corrected histogram\n");
+		exit(1);
+	}
+	for (i=0; i<rp->bins; i++) {
+		cor.histo[i] = rp->histo[i];
+		cor.histo[i].delta_count += hp[i].delta_count;
+		cor.histo[i].delta_sum   += hp[i].delta_sum;
+	}
+	stats_merge(&cor.stats, sp);
+
+	for (i=0; i<ARRAY_SIZE(pcts); i++) {
+		snprintf(label, sizeof(label), "  %s %g%%", what, pcts[i]);
+		printf("%-24s: %8s  %8s\n", label, t2ts(histo_percentile(rp, pcts[i]), rp->tpns),
+		    t2ts(histo_percentile(&cor, pcts[i]), rp->tpns));
+	}
+	snprintf(label, sizeof(label), "  %s max", what);
+	printf("%-24s: %8s  %8s\n", label, t2ts(rp->stats.max, rp->tpns),
+	    t2ts(cor.stats.max, rp->tpns));
+	free(cor.histo);
+}
+
+/*!
+ * \brief Report percentiles with and without coordinated omission correction
+ * \param rp   Results of the run
+ * \param late Block start lateness results, or NULL without --interval
+ */
+void
+co_report(const results_t *rp, const results_t *late) {
+	printf("Coordinated omission    : expected interval %s, %" PRIu64
+	    " deltas synthesized", t2ts(co.ticks, rp->tpns), co.stats.count);
+	if (late != NULL)
+		printf(", %" PRIu64 " block starts synthesized", co.late_stats.count);
+	printf("\n%-24s: %8s  %8s\n", "Percentile", "Raw", "Corrected");
+	co_print("Delta", rp, co.histo, &co.stats);
+	if (late != NULL)
+		co_print("Lateness", late, co.late, &co.late_stats);
+}
+
+/*! Type for the state of fixed-rate blocks started on TSC deadlines */
+typedef struct pace_stct {
+/*! Ticks between block deadlines, 0 if not pacing */
+	uint64_t ticks;
+/*! TSC deadline of the next block */
+	uint64_t next;
+/*! Number of blocks started */
+	uint64_t blocks;
+/*! Number of deadlines that passed with no block started */
+	uint64_t missed;
+/*! Histogram of how late each block started, with the same bins as histo */
+	bin_t *late;
+/*! Statistics of how late each block started */
+	stats_t stats;
+} pace_t;
+
+/*! State of fixed-rate blocks */
+pace_t pace;
+
+/*!
+ * \brief Set the block deadline interval and set up the lateness histogram
+ * \param tpns Ticks per nanosecond calibrated before the run
+ */
+void
+pace_setup(double tpns) {
+	uint64_t i;
+
+	pace.ticks = (uint64_t)(args.interval*1000*tpns);
+	if (pace.ticks == 0)
+		pace.ticks = 1;
+	if ((pace.late=(bin_t *)buf_alloc(sizeof(bin_t)*args.bins,
+	    "Lateness histogram")) == NULL) {
+		fprintf(stderr, "Couldn't allocate memory for lateness histogram\n");
+		exit(1);
+	}
+	for (i=0; i<args.bins; i++)
+		pace.late[i].ub = histo[i].ub;
+	pace.stats.min = UINT64_MAX;
+}
+
+/*!
+ * \brief Spin until the next block deadline and record how late it started
+ *
+ * Deadlines stay on a fixed grid from the start of the run, so blocks are
+ * uniformly spaced in time.
+ * The block is late relative to the deadline it was waiting for, however
+ * long a stall was, and later deadlines that already passed are counted
+ * as missed and skipped.
+ */
+void
+pace_wait() {
+	uint64_t now, late, n;
+
+	rdtsc(now);
+	while (now < pace.next) {
+		asm volatile ("pause");
+		rdtsc(now);
+	}
+	if ((late=now-pace.next) >= pace.ticks) {
+		n = late/pace.ticks;
+		pace.missed += n;
+		pace.next += n*pace.ticks;
+		if (co.late != NULL)
+			co_missed(late, n, pace.ticks);
+	}
+	pace.next += pace.ticks;
+	pace.blocks++;
+	histo_add(pace.late, &pace.stats, late);
+}
+
+/*!
+ * \brief Report fixed-rate deadlines missed and the block start lateness histogram
+ * \param tpns Ticks per nanosecond measured over the run
+ * \param lp   Lateness results to fill in for later reports
+ */
+void
+pace_report(double tpns, results_t *lp) {
+	memset(lp, 0, sizeof(*lp));
+	lp->histo = pace.late;
+	lp->bins = args.bins;
+	lp->stats = pace.stats;
+	lp->tpns = tpns;
+
+	printf("Fixed-rate blocks       : every %s, %" PRIu64 " started, %" PRIu64
+	    " deadlines missed (%.4f%%)\n", t2ts(pace.ticks, tpns), pace.blocks,
+	    pace.missed, 100.0*pace.missed/(pace.blocks+pace.missed));
+	printf("\nBlock start lateness after each deadline:\n");
+	histo_print(lp);
+	printf("Lateness Min / Average / 99.9%% / Max : %s / %s / %s / %s\n",
+	    t2ts(pace.stats.min, tpns), t2ts(pace.stats.sum/pace.stats.count, tpns),
+	    t2ts(histo_percentile(lp, 99.9), tpns), t2ts(pace.stats.max, tpns));
+}
+
+#ifndef _WIN32
+/*!
+ * \brief Type for the state of the shared memory export
+ *
+ * Outliers are staged in a private ring by the outlier loop and the
+ * histogram is updated in place by the analysis kernel, so the segment
+ * is only written when publishing, every SHM_MS.
+ */
+typedef struct shm_stct {
+/*! Mapped segment, NULL if not exporting */
+	shm_hdr_t *hdr;
+/*! Histogram table in the segment */
+	bin_t *bins;
+/*! Recent outlier ring in the segment */
+	outlier_t *outliers;
+/*! Private ring of recent outliers, SHM_OUTLIERS entries */
+	outlier_t *ring;
+/*! Number of outliers staged in ring so far */
+	uint64_t n;
+/*! Ticks between publishes, 0 if not exporting */
+	uint64_t ticks;
+/*! TSC when the next publish is due */
+	uint64_t deadline;
+/*! Ticks per nanosecond calibrated before the run */
+	double tpns;
+/*! Statistics being updated by the timing thread */
+	const stats_t *stats;
+} shm_t;
+
+/*! State of the shared memory export */
+shm_t shm;
+
+/*!
+ * \brief Create and map the shared memory export segment
+ * \param name Name of POSIX shared memory object, like "/sljtest"
+ * \param sp   Statistics the timing thread will update
+ * \param tpns Ticks per nanosecond calibrated before the run
+ *
+ * Every page of the segment is written here, so publishing never faults.
+ */
+void
+shm_setup(const char *name, const stats_t *sp, double tpns) {
+	shm_hdr_t *hp;
+	results_t results;
+	struct timeval tv;
+	size_t bins_off, size;
+	int fd;
+
+	shm.stats = sp;
+	shm.tpns = tpns;
+	shm.ticks = (uint64_t)(shm.tpns*1E6*SHM_MS);
+	if ((shm.ring=(outlier_t *)buf_alloc(sizeof(outlier_t)*SHM_OUTLIERS,
+	    "Shared memory outlier ring")) == NULL) {
+		fprintf(stderr, "Couldn't allocate memory for shared memory export\n");
+		exit(1);
+	}
+
+	/* Histogram follows the header, then the outlier ring */
+	bins_off = sizeof(shm_hdr_t)-offsetof(shm_hdr_t, snap);
+	size = sizeof(shm_hdr_t) + sizeof(bin_t)*args.bins + sizeof(outlier_t)*SHM_OUTLIERS;
+	if ((fd=shm_open(name, O_CREAT|O_RDWR|O_TRUNC, 0644)) < 0) {
+		fprintf(stderr, "Unable to create shared memory segment %s: %s\n",
+		    name, strerror(errno));
+		exit(1);
+	}
+	if (ftruncate(fd, size) != 0) {
+		fprintf(stderr, "Unable to size shared memory segment %s: %s\n",
+		    name, strerror(errno));
+		exit(1);
+	}
+	hp = (shm_hdr_t *)mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hp == MAP_FAILED) {
+		fprintf(stderr, "Unable to map shared memory segment %s: %s\n",
+		    name, strerror(errno));
+		exit(1);
+	}
+	memset(hp, 0, size);
+
+	memset(&results, 0, sizeof(results));
+	results.bins = args.bins;
+	results.stats = *sp;
+	results.tpns = shm.tpns;
+	gettimeofday(&tv, NULL);
+	snap_fill(&hp->snap, &results, tv.tv_sec*1000000ULL+tv.tv_usec);
+	hp->snap.bins_off = bins_off;
+	hp->snap.file_size = bins_off + sizeof(bin_t)*args.bins;
+	strncpy(hp->magic, SHM_MAGIC, sizeof(hp->magic));
+	hp->version = SHM_VERSION;
+	hp->hdr_size = sizeof(*hp);
+	hp->size = size;
+	hp->outliers_off = sizeof(shm_hdr_t) + sizeof(bin_t)*args.bins;
+	hp->outliers_len = SHM_OUTLIERS;
+	hp->pid = getpid();
+
+	shm.bins = (bin_t *)((char *)&hp->snap+bins_off);
+	shm.outliers = (outlier_t *)((char *)hp+hp->outliers_off);
+	memcpy(shm.bins, histo, sizeof(bin_t)*args.bins);
+	shm.hdr = hp;
+}
+
+/*!
+ * \brief Set the time of the first publish
+ * \param start_tsc TSC at the start of the run
+ */
+void
+shm_start(uint64_t start_tsc) {
+	shm.hdr->start_tsc = start_tsc;
+	shm.deadline = start_tsc+shm.ticks;
+}
+
+/*!
+ * \brief Copy results into the segment under the seqlock
+ * \param rp   Results to publish, with the histogram in rp->histo
+ * \param done Nonzero if these are the final results
+ *
+ * This is the only writer, so seq is read without atomics.
+ * The release fence keeps the stores below from being seen before seq
+ * goes odd, and the release store keeps them from being seen after it
+ * goes even again.
+ */
+void
+shm_write(const results_t *rp, int done) {
+	shm_hdr_t *hp = shm.hdr;
+	uint64_t seq = hp->seq;
+	size_t lv;
+
+	__atomic_store_n(&hp->seq, seq+1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	snap_stats(&hp->snap, rp);
+	memcpy(shm.bins, rp->histo, sizeof(bin_t)*rp->bins);
+	memcpy(shm.outliers, shm.ring, sizeof(outlier_t)*SHM_OUTLIERS);
+	hp->outliers = shm.n;
+	for (lv=0; rollup.ticks!=0 && lv<ARRAY_SIZE(rollup.level); lv++) {
+		const level_t *lp = &rollup.level[lv];
+
+		hp->windows[lv] = lp->n;
+		if (lp->n != 0)
+			hp->last[lv] = lp->ring[(lp->n-1) % lp->len];
+		hp->worst[lv] = lp->worst;
+	}
+	hp->publishes++;
+	hp->done = done;
+
+	__atomic_store_n(&hp->seq, seq+2, __ATOMIC_RELEASE);
+}
+
+/*!
+ * \brief Publish results so far to the segment
+ * \param now          TSC at the end of the block just taken
+ * \param timing_ticks TSC ticks spent in timing measurements so far
+ *
+ * Called between blocks when the publish deadline has passed.
+ * Publishes missed during a stall are skipped, not caught up.
+ */
+void
+shm_publish(uint64_t now, uint64_t timing_ticks) {
+	results_t results;
+
+	results.histo = histo;
+	results.bins = args.bins;
+	results.stats = *shm.stats;
+	results.tpns = shm.tpns;
+	results.timing_ticks = timing_ticks;
+	results.run_ticks = now-shm.hdr->start_tsc;
+	results.run_us = results.run_ticks/shm.tpns/1000;
+	shm_write(&results, 0);
+	shm.deadline = now+shm.ticks;
+}
+
+/*!
+ * \brief Publish the final results and report on the export
+ * \param rp Final results of the run
+ *
+ * The segment is left in place so it can be read after the run.
+ */
+void
+shm_finish(const results_t *rp) {
+	shm_write(rp, 1);
+	printf("Shared memory export    : %" PRIu64 " publishes to %s\n",
+	    shm.hdr->publishes, args.shm);
+}
+
+/*!
+ * \brief Read a consistent snapshot from a shared memory export and report on it
+ * \param name Name of POSIX shared memory object
+ * \return 0 if reported, 1 otherwise
+ */
+int
+shm_peek(const char *name) {
+	const shm_hdr_t *hp;
+	shm_hdr_t *copy;
+	outlier_t *ring, *op;
+	results_t results;
+	struct stat st;
+	uint64_t seq, i, n, len;
+	size_t size;
+	time_t when;
+	int fd, tries;
+
+	if ((fd=shm_open(name, O_RDONLY, 0)) < 0) {
+		fprintf(stderr, "Unable to open shared memory segment %s: %s\n",
+		    name, strerror(errno));
+		return (1);
+	}
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(shm_hdr_t)) {
+		fprintf(stderr, "%s: too short to be a shared memory export\n", name);
+		close(fd);
+		return (1);
+	}
+	hp = (const shm_hdr_t *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hp == MAP_FAILED) {
+		perror(name);
+		return (1);
+	}
+	if (memcmp(hp->magic, SHM_MAGIC, sizeof(SHM_MAGIC)) != 0) {
+		fprintf(stderr, "%s: not a shared memory export\n", name);
+		return (1);
+	}
+	if (hp->version != SHM_VERSION) {
+		fprintf(stderr, "%s: shared memory export version %u, expected %u\n",
+		    name, hp->version, SHM_VERSION);
+		return (1);
+	}
+
+	/* Layout is fixed once the writer sets it up, so check it once */
+	size = offsetof(shm_hdr_t, snap)+hp->snap.file_size;
+	len = hp->outliers_len;
+	if (hp->size != (uint64_t)st.st_size || hp->snap.bins < 2 ||
+	    hp->snap.bins_off%8 != 0 || size > hp->outliers_off ||
+	    hp->outliers_off+sizeof(outlier_t)*len > hp->size) {
+		fprintf(stderr, "%s: shared memory export is corrupt\n", name);
+		return (1);
+	}
+	copy = (shm_hdr_t *)malloc(size);
+	ring = (outlier_t *)malloc(sizeof(outlier_t)*len);
+	if (copy==NULL || ring==NULL) {
+		fprintf(stderr, "Couldn't allocate memory for shared memory snapshot\n");
+		return (1);
+	}
+
+	/* Copy, then retry if the writer was publishing before or during the copy */
+	for (tries=0; ; tries++) {
+		if (tries == SHM_RETRIES) {
+			fprintf(stderr, "%s: writer never finished publishing\n", name);
+			return (1);
+		}
+		seq = __atomic_load_n(&hp->seq, __ATOMIC_ACQUIRE);
+		if (!(seq&1)) {
+			memcpy(copy, hp, size);
+			memcpy(ring, (const char *)hp+hp->outliers_off, sizeof(outlier_t)*len);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&hp->seq, __ATOMIC_RELAXED) == seq)
+				break;
+		}
+		SLEEP_MSEC(1);
+	}
+	if (copy->publishes == 0) {
+		fprintf(stderr, "%s: nothing published yet\n", name);
+		return (1);
+	}
+
+	/* Report with the writer's histogram settings */
+	snap_results(&copy->snap, &results);
+	args.bins = copy->snap.bins;
+	args.knee = copy->snap.knee;
+	args.min = copy->snap.min;
+	histo_print(&results);
+	stats_print(&results);
+	when = (time_t)copy->snap.start_time;
+	printf("Shared memory export of : %s CPU %d (%s), PID %d %s, started %s",
+	    copy->snap.host, copy->snap.cpu, copy->snap.cpu_model, copy->pid,
+	    copy->done ? "finished" : "running", ctime(&when));
+	printf("Shared memory publishes : %" PRIu64 ", %" PRIu64 " outliers\n",
+	    copy->publishes, copy->outliers);
+	for (i=0; i<ARRAY_SIZE(copy->windows); i++) {
+		static const char *names[] = {"1ms", "1s", "1min"};
+
+		if (copy->windows[i] == 0)
+			continue;
+		roll_print("Last", names[i], &copy->last[i], copy->start_tsc, results.tpns);
+		roll_print("Worst", names[i], &copy->worst[i], copy->start_tsc, results.tpns);
+	}
+
+	/* Oldest first, in the same ms, us, position format as the outlier file */
+	n = copy->outliers;
+	if (n != 0)
+		printf("Recent outliers (ms since start, us, position in block):\n");
+	for (i=(n>len) ? n-len : 0; i<n; i++) {
+		op = &ring[i % len];
+		printf("%f, %f, %d\n", (op->when-copy->start_tsc)/results.tpns/1000000.0,
+		    op->delta/results.tpns/1000.0, op->pos);
+	}
+	free(copy);
+	free(ring);
+	return (0);
+}
+#endif	/* _WIN32 */
+
+#ifdef	__linux__
+/*! Type for one interval of effective frequency */
+typedef struct freq_sample_stct {
+/*! TSC at the end of the interval */
+	uint64_t tsc;
+/*! Effective core frequency over the interval (MHz) */
+	double mhz;
+} freq_sample_t;
+
+/*! Type for the state of effective frequency monitoring */
+typedef struct freq_stct {
+/*! CPU being measured */
+	int cpu;
+/*! File descriptor of the CPU's msr device, or -1 to use cpufreq */
+	int msr;
+/*! Path of the CPU's scaling_cur_freq */
+	char cur_freq[64];
+/*! Samples taken so far, one per interval */
+	freq_sample_t *samples;
+/*! Number of samples */
+	size_t n;
+/*! Number of samples allocated */
+	size_t size;
+/*! Ticks per nanosecond calibrated before the run */
+	double tpns;
+/*! Set when the timing thread is done */
+	int done;
+/*! Sampler thread */
+	pthread_t helper;
+} freq_t;
+
+/*! State of effective frequency monitoring */
+freq_t freq;
+
+/*!
+ * \brief Read the APERF and MPERF counters of the measured CPU
+ * \param aperf Actual performance clock count
+ * \param mperf Maximum performance clock count, at the TSC rate
+ * \return 0 if read, -1 otherwise
+ */
+int
+freq_read_msr(uint64_t *aperf, uint64_t *mperf) {
+	return ((pread(freq.msr, aperf, sizeof(*aperf), MSR_APERF) == sizeof(*aperf) &&
+	    pread(freq.msr, mperf, sizeof(*mperf), MSR_MPERF) == sizeof(*mperf)) ? 0 : -1);
+}
+
+/*!
+ * \brief Sampler thread: record effective frequency every FREQ_MS
+ * \param arg Unused
+ * \return NULL
+ *
+ * APERF counts at the core clock and MPERF at the TSC rate while the core
+ * runs, so their ratio scales the TSC rate to the effective frequency.
+ * Without them, cpufreq's idea of the current frequency is sampled.
+ */
+void *
+freq_helper(void *arg) {
+	uint64_t aperf, mperf, aprev = 0, mprev = 0, now;
+	freq_sample_t *sp;
+	char *text;
+
+	(void)arg;
+	helper_setup();
+	if (freq.msr >= 0 && freq_read_msr(&aprev, &mprev) != 0)
+		return (NULL);
+	while (!__atomic_load_n(&freq.done, __ATOMIC_ACQUIRE)) {
+		SLEEP_MSEC(FREQ_MS);
+		if (freq.n == freq.size) {
+			freq.size = freq.size ? 2*freq.size : 1024;
+			if ((sp=realloc(freq.samples, sizeof(*sp)*freq.size)) == NULL)
+				return (NULL);
+			freq.samples = sp;
+		}
+		sp = &freq.samples[freq.n];
+		rdtsc(now);
+		sp->tsc = now;
+		if (freq.msr >= 0) {
+			if (freq_read_msr(&aperf, &mperf) != 0)
+				return (NULL);
+			if (mperf == mprev)
+				continue;
+			sp->mhz = freq.tpns*1E3*(aperf-aprev)/(mperf-mprev);
+			aprev = aperf;
+			mprev = mperf;
+		} else {
+			if ((text=file_read(freq.cur_freq)) == NULL)
+				return (NULL);
+			sp->mhz = strtod(text, NULL)/1E3;
+			free(text);
+		}
+		/* Publish only complete samples */
+		__atomic_store_n(&freq.n, freq.n+1, __ATOMIC_RELEASE);
+	}
+	return (NULL);
+}
+
+/*!
+ * \brief Find a frequency source for the CPU the timing thread is on and start sampling
+ *
+ * \param tpns Ticks per nanosecond calibrated before the run
+ *
+ * Leaves freq.tpns 0 if no source is readable.
+ */
+void
+freq_setup(double tpns) {
+	char path[64];
+	char *text;
+
+	freq.cpu = sched_getcpu();
+	snprintf(path, sizeof(path), "/dev/cpu/%d/msr", freq.cpu);
+	snprintf(freq.cur_freq, sizeof(freq.cur_freq),
+	    "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", freq.cpu);
+	if ((freq.msr=open(path, O_RDONLY)) >= 0) {
+		uint64_t aperf, mperf;
+
+		if (freq_read_msr(&aperf, &mperf) != 0) {
+			close(freq.msr);
+			freq.msr = -1;
+		}
+	}
+	if (freq.msr < 0) {
+		if ((text=file_read(freq.cur_freq)) == NULL) {
+			printf("Effective frequency     : not available, no readable msr or cpufreq for CPU %d\n",
+			    freq.cpu);
+			return;
+		}
+		free(text);
+	}
+
+	freq.tpns = tpns;
+	if (pthread_create(&freq.helper, NULL, freq_helper, NULL) != 0) {
+		fprintf(stderr, "Couldn't start frequency sampler thread\n");
+		exit(1);
+	}
+}
+
+/*! \brief Stop sampling at the end of the run */
+void
+freq_stop() {
+	__atomic_store_n(&freq.done, 1, __ATOMIC_RELEASE);
+	pthread_join(freq.helper, NULL);
+	if (freq.msr >= 0)
+		close(freq.msr);
+}
+
+/*!
+ * \brief Report and write effective frequency per interval
+ * \param start_tsc TSC at the start of the run
+ *
+ * A change of more than FREQ_STEP_PCT between intervals counts as a transition.
+ */
+void
+freq_report(uint64_t start_tsc) {
+	const freq_sample_t *sp;
+	double min = INFINITY, max = 0, sum = 0;
+	uint64_t transitions = 0;
+	size_t n;
+	FILE *fp;
+
+	if ((n=freq.n) == 0) {
+		printf("Effective frequency     : no intervals sampled on CPU %d\n", freq.cpu);
+		return;
+	}
+
+	for (sp=freq.samples; sp<freq.samples+n; sp++) {
+		if (sp->mhz < min)
+			min = sp->mhz;
+		if (sp->mhz > max)
+			max = sp->mhz;
+		sum += sp->mhz;
+		if (sp > freq.samples &&
+		    fabs(sp->mhz-sp[-1].mhz) > sp[-1].mhz*FREQ_STEP_PCT/100)
+			transitions++;
+	}
+	printf("Effective frequency     : %.0f / %.0f / %.0f MHz min / mean / max on CPU %d from %s,"
+	    " %.2fx TSC rate\n", min, sum/n, max, freq.cpu,
+	    (freq.msr >= 0) ? "APERF/MPERF" : "cpufreq", sum/n/(freq.tpns*1E3));
+	printf("Frequency transitions   : %" PRIu64 " in %zd intervals of %dms\n",
+	    transitions, n, FREQ_MS);
+
+	if ((fp=fopen(args.freq, "w")) == NULL) {
+		fprintf(stderr, "Unable to create frequency file %s\n", args.freq);
+		perror(args.freq);
+		return;
+	}
+	fprintf(fp, "# end ms, MHz\n");
+	for (sp=freq.samples; sp<freq.samples+n; sp++) {
+		fprintf(fp, "%f, %.1f\n", (int64_t)(sp->tsc-start_tsc)/freq.tpns/1E6,
+		    sp->mhz);
+	}
+	fclose(fp);
+	printf("Frequency file          : %s\n", args.freq);
+}
+#endif	/* __linux__ */
+
+/*!
+ * \brief Handle the outliers of one block
+ * \param deltas  Block of BLOCK_DELTAS deltas
+ * \param outmask Outlier mask returned by the analysis kernel
+ * \param when    TSC at the start of the block
+ *
+ * Used by both main() and bench(), so the benchmark times the real walk.
+ * Each delta started at when plus the deltas before it, so exact
+ * timestamps cost nothing until an outlier is found.
+ */
+static inline void
+outliers_walk(const uint64_t *deltas, uint32_t outmask, uint64_t when) {
+	const uint64_t *dp;
+
+	for (dp=deltas; outmask!=0; when+=*dp++, outmask>>=1) {
+		if (!(outmask&1))
+			continue;
+
+		/* Merge outliers close together into one event */
+		event_add(when, *dp);
+
+		/* Largest outlier in this rollup window */
+		if (*dp > rollup.level[0].max)
+			rollup.level[0].max = *dp;
+
+		/* Synthesize samples a paced run missed during a stall */
+		if (co.ticks!=0 && *dp>co.ticks)
+			co_add(*dp);
+
+#ifndef _WIN32
+		/* Plain store, the render thread swaps in 0 each interval */
+		if (*dp > live.max)
+			__atomic_store_n(&live.max, *dp, __ATOMIC_RELAXED);
+
+		/* Save context around big outliers */
+		if (fr.ring!=NULL && *dp>args.trigger)
+			fr_trigger(when, *dp, dp-deltas);
+
+		/* Stage recent outliers, copied out when publishing */
+		if (shm.ring != NULL) {
+			outlier_t *sop = &shm.ring[shm.n++ % SHM_OUTLIERS];
+			sop->when = when;
+			sop->delta = *dp;
+			sop->pos = dp-deltas;
+		}
+#endif	/* _WIN32 */
+
+		/* If an outlier should be recorded */
+		if (outbuf != NULL) {
+			obp->when = when;
+			obp->delta = *dp;
+			obp->pos = dp-deltas;
+			obp++;
+			/* Wrap around if needed */
+			if (obp-outbuf >= args.outbuf) {
+				obp = outbuf;
+				didwrap = 1;
+			}
+		}
+	}
+}
+
+/*!
+ * \brief Clear everything the analysis kernel and outliers_walk() update
+ * \param sp Statistics to clear
+ *
+ * Called before each benchmark pass and after the last, so the benchmark
+ * leaves no trace in the histogram, events, or outlier buffer.
+ */
+void
+bench_reset(stats_t *sp) {
+	ebin_t *ebp;
+	uint64_t i;
+
+	memset(sp, 0, sizeof(*sp));
+	sp->min = UINT64_MAX;
+	for (i=0; i<args.bins; i++) {
+		histo[i].delta_count = 0;
+		histo[i].delta_sum   = 0;
+	}
+	memset(&events.cur, 0, sizeof(events.cur));
+	for (ebp=events.histo; ebp<events.histo+events.bins; ebp++)
+		ebp->events = ebp->deltas = ebp->sum = 0;
+	events.next = events.buf;
+	events.didwrap = 0;
+	rollup.level[0].max = 0;
+#ifndef _WIN32
+	live.max = 0;
+#endif	/* _WIN32 */
+	obp = outbuf;
+	didwrap = 0;
+}
+
+/*!
+ * \brief Next number from a xorshift generator, for synthetic benchmark streams
+ * \param state Generator state, never 0
+ * \return Pseudo-random 64-bit number
+ */
+static inline uint64_t
+bench_rand(uint64_t *state) {
+	uint64_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return (*state = x);
+}
+
+/*!
+ * \brief Fill a buffer with a synthetic delta stream
+ * \param shape  0 for bimodal, 1 for heavy-tailed, 2 for all outliers
+ * \param deltas Buffer of BENCH_DELTAS to fill
+ *
+ * Streams are shaped relative to the min and knee in effect, so they
+ * exercise the same bins a real run would.
+ * A fixed seed makes runs comparable.
+ */
+void
+bench_stream(int shape, uint64_t *deltas) {
+	uint64_t state = 0x9E3779B97F4A7C15ULL, span = args.knee-args.min, i;
+	double u;
+
+	for (i=0; i<BENCH_DELTAS; i++) {
+		/* Uniform in (0, 1] */
+		u = ((bench_rand(&state) >> 11) + 1) * 0x1.0p-53;
+		switch (shape) {
+		case 0:
+			/* Two peaks below the knee, like a cache hit and miss */
+			deltas[i] = (u < 0.7) ?
+			    args.min + (uint64_t)(u/0.7*span/3) :
+			    args.knee - (uint64_t)((u-0.7)/0.3*span/3);
+			break;
+		case 1:
+			/* Pareto with shape 1.5 starting at min, about 9% over a knee of 5 min */
+			deltas[i] = (uint64_t)fmin(args.min/pow(u, 1/1.5), 1E12);
+			break;
+		default:
+			/* Every delta is above the knee, spread over decades */
+			deltas[i] = args.knee+1 + (uint64_t)fmin(args.knee/u, 1E12);
+			break;
+		}
+	}
+}
+
+#ifdef	__linux__
+/*!
+ * \brief Open a counter of branch misses by this thread
+ * \return File descriptor of a disabled counter, or -1 if unavailable
+ */
+int
+bench_perf_open() {
+	struct perf_event_attr pe;
+
+	memset(&pe, 0, sizeof(pe));
+	pe.type = PERF_TYPE_HARDWARE;
+	pe.size = sizeof(pe);
+	pe.config = PERF_COUNT_HW_BRANCH_MISSES;
+	pe.disabled = 1;
+	pe.exclude_kernel = 1;
+	pe.exclude_hv = 1;
+	return ((int)syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0));
+}
+#endif	/* __linux__ */
+
+/*!
+ * \brief Benchmark the analysis engine on synthetic delta streams
+ * \param analyze_block Analysis kernel to benchmark
+ * \return Exit status
+ *
+ * Each stream goes through the kernel and the same outlier walk as the
+ * timing loop in main(), BENCH_PASSES times, and the fastest pass is
+ * reported.
+ * Duty cycle is the fraction of each loop spent taking timestamps, given
+ * the measured cost of a block of timestamps and of the end-of-run check.
+ */
+int
+bench(block_fn_t analyze_block) {
+	uint64_t *deltas, *dp;
+	uint64_t t0, t1, t10;
+	uint64_t block[BLOCK_DELTAS];
+	uint64_t timing = 0, loop, when, best, ticks, misses, best_misses, outliers;
+	uint32_t outmask;
+	struct timeval now_gtod;
+	stats_t stats;
+	double tpns;
+	int shape, pass, fd = -1;
+	long i;
+
+	if ((deltas=(uint64_t *)buf_alloc(sizeof(uint64_t)*BENCH_DELTAS,
+	    "Benchmark buffer")) == NULL) {
+		fprintf(stderr, "Couldn't allocate memory for benchmark streams\n");
+		return (1);
+	}
+	tpns = tsc_calibrate(CALIBRATE_MS);
+
+	/* Cost of a block of timestamps as taken in main() */
+	for (i=0; i<BENCH_BLOCKS; i++) {
+		ts_block(block, t0, t10, (void)0);
+		asm volatile ("" : : "r" (block) : "memory");	/* Keep the stores main() needs */
+		timing += t10-t0;
+	}
+	timing /= BENCH_BLOCKS;
+
+	/* Cost of the stop TSC and time of day taken after every block */
+	rdtsc(t0);
+	for (i=0; i<BENCH_BLOCKS; i++) {
+		rdtsc(t1);
+		gettimeofday(&now_gtod, NULL);
+	}
+	rdtsc(t10);
+	loop = (t10-t0)/BENCH_BLOCKS;
+
+	printf("Analysis kernel         : %s\n", block_name(analyze_block));
+	printf("Timestamp block         : %" PRIu64 " ticks (%s) for %d deltas\n",
+	    timing, t2ts(timing, tpns), BLOCK_DELTAS);
+	printf("Loop overhead           : %" PRIu64 " ticks (%s) per block\n",
+	    loop, t2ts(loop, tpns));
+
+#ifdef	__linux__
+	if ((fd=bench_perf_open()) < 0)
+		printf("Branch misses           : not counted (%s)\n", strerror(errno));
+#endif	/* __linux__ */
+
+	printf("\n%-12s %9s %11s %14s %9s %10s\n", "Stream", "ns/delta",
+	    "ticks/delta", "br miss/delta", "outliers", "duty cycle");
+	for (shape=0; shape<(int)ARRAY_SIZE(bench_shapes); shape++) {
+		bench_stream(shape, deltas);
+		best = UINT64_MAX;
+		best_misses = 0;
+		outliers = 0;
+		for (pass=0; pass<BENCH_PASSES; pass++) {
+			bench_reset(&stats);
+#ifdef	__linux__
+			if (fd >= 0) {
+				ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+				ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+			}
+#endif	/* __linux__ */
+			rdtsc(t0);
+			for (dp=deltas; dp<deltas+BENCH_DELTAS; dp+=BLOCK_DELTAS) {
+				/* Sum of deltas so far stands in for the block's start TSC */
+				when = stats.sum;
+				outmask = analyze_block(dp, &stats);
+				outliers_walk(dp, outmask, when);
+			}
+			rdtsc(t1);
+			for (i=args.bins/2, outliers=0; i<(long)args.bins; i++)
+				outliers += histo[i].delta_count;
+			misses = 0;
+#ifdef	__linux__
+			if (fd >= 0) {
+				ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+				if (read(fd, &misses, sizeof(misses)) != sizeof(misses))
+					misses = 0;
+			}
+#endif	/* __linux__ */
+			ticks = t1-t0;
+			if (ticks < best) {
+				best = ticks;
+				best_misses = misses;
+			}
+		}
+
+		/* Analysis for one block, per delta and as a share of each loop */
+		double per_block = (double)best/(BENCH_DELTAS/BLOCK_DELTAS);
+		printf("%-12s %9.2f %11.2f ", bench_shapes[shape],
+		    per_block/BLOCK_DELTAS/tpns, per_block/BLOCK_DELTAS);
+		if (fd >= 0)
+			printf("%14.4f ", (double)best_misses/BENCH_DELTAS);
+		else
+			printf("%14s ", "n/a");
+		printf("%8.1f%% %9.1f%%\n", 100.0*outliers/BENCH_DELTAS,
+		    100.0*timing/(timing+loop+per_block));
+	}
+
+#ifdef	__linux__
+	if (fd >= 0)
+		close(fd);
+#endif	/* __linux__ */
+	bench_reset(&stats);
+	return (0);
+}
+
+/*! Type for a synthetic work unit timed between timestamps */
+typedef void (*work_fn_t)(void);
+
+/*! Type for the state of the synthetic work unit */
+typedef struct work_stct {
+/*! Work unit, NULL for back to back timestamps */
+	work_fn_t fn;
+/*! Size of work unit, in iterations or bytes */
+	uint64_t n;
+/*! Bytes to hash or copy */
+	uint8_t *src;
+/*! Bytes copied to */
+	uint8_t *dst;
+/*! Numbers to parse */
+	char *text;
+/*! Results of work, so it isn't optimized away */
+	uint64_t sink;
+} work_t;
+
+/*! Synthetic work unit */
+work_t work;
+
+/*! \brief Work unit: hash a message-sized buffer with FNV-1a, n times */
+void
+work_hash() {
+	uint64_t h = 14695981039346656037ULL, i;
+	const uint8_t *p;
+
+	for (i=0; i<work.n; i++) {
+		for (p=work.src; p<work.src+WORK_MSG_BYTES; p++)
+			h = (h ^ *p) * 1099511628211ULL;
+	}
+	work.sink += h;
+}
+
+#ifdef	SIMD_KERNELS
+/*! \brief Work unit: n rounds of 8 independent AVX-512 FMAs */
+__attribute__((target("avx512f")))
+void
+work_fma() {
+	__m512 a0 = _mm512_set1_ps(1.0f), a1 = a0, a2 = a0, a3 = a0;
+	__m512 a4 = a0, a5 = a0, a6 = a0, a7 = a0;
+	const __m512 b = _mm512_set1_ps(1.0000001f), c = _mm512_set1_ps(1E-7f);
+	uint64_t i;
+
+	for (i=0; i<work.n; i++) {
+		a0 = _mm512_fmadd_ps(a0, b, c);
+		a1 = _mm512_fmadd_ps(a1, b, c);
+		a2 = _mm512_fmadd_ps(a2, b, c);
+		a3 = _mm512_fmadd_ps(a3, b, c);
+		a4 = _mm512_fmadd_ps(a4, b, c);
+		a5 = _mm512_fmadd_ps(a5, b, c);
+		a6 = _mm512_fmadd_ps(a6, b, c);
+		a7 = _mm512_fmadd_ps(a7, b, c);
+	}
+	a0 = _mm512_add_ps(_mm512_add_ps(_mm512_add_ps(a0, a1), _mm512_add_ps(a2, a3)),
+	    _mm512_add_ps(_mm512_add_ps(a4, a5), _mm512_add_ps(a6, a7)));
+	work.sink += (uint64_t)_mm512_reduce_add_ps(a0);
+}
+#endif	/* SIMD_KERNELS */
+
+/*! \brief Work unit: parse n random signed decimal numbers, branching on each character */
+void
+work_parse() {
+	const char *p;
+	uint64_t sum = 0, v = 0;
+	int neg = 0;
+
+	for (p=work.text; *p!='\0'; p++) {
+		if (*p >= '0' && *p <= '9') {
+			v = v*10 + (*p-'0');
+		} else if (*p == '-') {
+			neg = 1;
+		} else {
+			sum += neg ? -v : v;
+			v = 0;
+			neg = 0;
+		}
+	}
+	work.sink += sum;
+}
+
+/*! \brief Work unit: copy n bytes */
+void
+work_memcpy() {
+	memcpy(work.dst, work.src, work.n);
+	work.sink += work.dst[work.n-1];
+}
+
+/*!
+ * \brief Set up the work unit timed between timestamps
+ * \param spec Work unit as kind or kind:n
+ *
+ * Unless -m or -k were given, min is set below the fastest 1% of warm
+ * units and knee above the median, so the histogram covers them.
+ */
+void
+work_setup(const char *spec) {
+	/* Kinds of work, default size, and what the size counts */
+	static const struct {
+		const char *name;
+		work_fn_t fn;
+		uint64_t n;
+		const char *unit;
+	} kinds[] = {
+		{"hash",   work_hash,   1,    "hashes of a message"},
+#ifdef	SIMD_KERNELS
+		{"fma",    work_fma,    100,  "rounds of 8 AVX-512 FMAs"},
+#endif	/* SIMD_KERNELS */
+		{"parse",  work_parse,  16,   "numbers parsed"},
+		{"memcpy", work_memcpy, 4096, "bytes copied"},
+	};
+	double cal[WORK_CALIBRATE];
+	uint64_t state = 0x9E3779B97F4A7C15ULL, t0, t1, i, typical, fast;
+	size_t k, len, used;
+
+	len = strcspn(spec, ":");
+	for (k=0; k<ARRAY_SIZE(kinds); k++) {
+		if (strlen(kinds[k].name) == len && strncmp(spec, kinds[k].name, len) == 0)
+			break;
+	}
+	if (k == ARRAY_SIZE(kinds)) {
+		fprintf(stderr, "Work unit (%s) must be hash, fma, parse, or memcpy,"
+		    " optionally followed by :n\n", spec);
+		exit(1);
+	}
+#ifdef	SIMD_KERNELS
+	if (kinds[k].fn == work_fma && !__builtin_cpu_supports("avx512f")) {
+		fprintf(stderr, "Work unit fma needs a CPU with AVX-512\n");
+		exit(1);
+	}
+#endif	/* SIMD_KERNELS */
+	work.fn = kinds[k].fn;
+	work.n = (spec[len] == ':') ? strtoull(spec+len+1, NULL, 0) : kinds[k].n;
+	if (work.n == 0) {
+		fprintf(stderr, "Work unit size (%s) must be > 0\n", spec+len+1);
+		exit(1);
+	}
+
+	/* Random bytes to hash or copy, and random numbers to parse */
+	len = (work.fn == work_memcpy) ? work.n : WORK_MSG_BYTES;
+	work.src = (uint8_t *)buf_alloc(len, "Work source buffer");
+	work.dst = (uint8_t *)buf_alloc(len, "Work destination buffer");
+	if (work.fn == work_parse)
+		work.text = (char *)buf_alloc(work.n*WORK_NUM_CHARS+1, "Work text buffer");
+	if (work.src==NULL || work.dst==NULL ||
+	    (work.fn == work_parse && work.text==NULL)) {
+		fprintf(stderr, "Couldn't allocate memory for work unit\n");
+		exit(1);
+	}
+	for (i=0; i<len; i++)
+		work.src[i] = (uint8_t)bench_rand(&state);
+	for (i=0, used=0; work.text!=NULL && i<work.n; i++) {
+		used += snprintf(work.text+used, WORK_NUM_CHARS+1, "%s%" PRIu64 ",",
+		    (bench_rand(&state) & 1) ? "-" : "",
+		    bench_rand(&state) % (uint64_t)pow(10, 1+bench_rand(&state)%9));
+	}
+
+	/* Warm caches and branch predictors first, then time units one at a time */
+	for (i=0; i<WORK_CALIBRATE; i++)
+		work.fn();
+	for (i=0; i<WORK_CALIBRATE; i++) {
+		rdtsc(t0);
+		work.fn();
+		rdtsc(t1);
+		cal[i] = t1-t0;
+	}
+	qsort(cal, WORK_CALIBRATE, sizeof(cal[0]), dbl_cmp);
+	typical = (uint64_t)cal[WORK_CALIBRATE/2];
+	fast = (uint64_t)cal[WORK_CALIBRATE/100];
+	printf("Work unit               : %" PRIu64 " %s, median %" PRIu64
+	    " ticks, 1%% %" PRIu64 " ticks with timestamp\n",
+	    work.n, kinds[k].unit, typical, fast);
+	if (args.min == DEF_MIN && args.knee == DEF_KNEE) {
+		args.min = fast*9/10;
+		args.knee = typical*3/2;
+		if (args.knee-args.min < args.bins/2)
+			args.knee = args.min+args.bins/2;
+		printf("Histogram min and knee  : %" PRIu64 " and %" PRIu64 " ticks for work unit\n",
+		    args.min, args.knee);
+	}
+}
+
+#ifndef _WIN32
+/*! Ways to idle a CPU for the C-state probe, in the order named by --cstates */
+enum cstate_methods {
+	CSTATE_SLEEP,		/*!< nanosleep(), letting the OS choose a C-state */
+	CSTATE_SPIN,		/*!< Spin on pause, entering no C-state */
+	CSTATE_UMWAIT,		/*!< umwait, entering C0.2 without the OS */
+};
+
+/*!
+ * \brief Read usage counts of the cpuidle states of a CPU
+ * \param cpu   CPU number
+ * \param usage Array of CSTATE_MAX counts of entries to fill
+ * \param name  Array of CSTATE_MAX state names to fill, or NULL
+ * \param lat   Array of CSTATE_MAX declared exit latencies (us) to fill, or NULL
+ * \return Number of states, 0 if cpuidle isn't available
+ */
+int
+cpuidle_read(int cpu, uint64_t *usage, char (*name)[16], unsigned *lat) {
+	char path[96], *text;
+	int n;
+
+	for (n=0; n<CSTATE_MAX; n++) {
+		snprintf(path, sizeof(path),
+		    "/sys/devices/system/cpu/cpu%d/cpuidle/state%d/usage", cpu, n);
+		if ((text=file_read(path)) == NULL)
+			break;
+		usage[n] = strtoull(text, NULL, 10);
+		free(text);
+		if (name != NULL) {
+			snprintf(path, sizeof(path),
+			    "/sys/devices/system/cpu/cpu%d/cpuidle/state%d/name", cpu, n);
+			snprintf(name[n], sizeof(name[n]), "?");
+			if ((text=file_read(path)) != NULL) {
+				snprintf(name[n], sizeof(name[n]), "%.*s",
+				    (int)strcspn(text, "\n"), text);
+				free(text);
+			}
+		}
+		if (lat != NULL) {
+			snprintf(path, sizeof(path),
+			    "/sys/devices/system/cpu/cpu%d/cpuidle/state%d/latency", cpu, n);
+			lat[n] = 0;
+			if ((text=file_read(path)) != NULL) {
+				lat[n] = (unsigned)strtoul(text, NULL, 10);
+				free(text);
+			}
+		}
+	}
+	return (n);
+}
+
+/*!
+ * \brief Idle until a TSC deadline
+ * \param method   CSTATE_SLEEP, CSTATE_SPIN, or CSTATE_UMWAIT
+ * \param deadline TSC to idle until
+ * \param ns       Length of idle (nanoseconds)
+ *
+ * Sleeping lets the OS pick a C-state, spinning on pause enters none and is
+ * the baseline, and umwait enters the light C0.2 state without the OS.
+ */
+void
+cstate_idle(int method, uint64_t deadline, uint64_t ns) {
+	struct timespec ts;
+	uint64_t now;
+
+	switch (method) {
+	case CSTATE_SLEEP:
+		ts.tv_sec  = ns / 1000000000;
+		ts.tv_nsec = ns % 1000000000;
+		nanosleep(&ts, NULL);
+		break;
+#ifdef	SIMD_KERNELS
+	case CSTATE_UMWAIT: {
+		volatile uint64_t line = 0;
+
+		/* Wait may end early at the OS limit or a store to the line */
+		do {
+			/* umonitor %rax, then umwait %ecx until %edx:%eax */
+			asm volatile (".byte 0xf3, 0x0f, 0xae, 0xf0"
+			    : : "a" (&line) : "memory");
+			asm volatile (".byte 0xf2, 0x0f, 0xae, 0xf1"
+			    : : "c" (0), "d" ((uint32_t)(deadline >> 32)),
+			    "a" ((uint32_t)deadline) : "cc", "memory");
+			rdtsc(now);
+		} while (now < deadline);
+		break;
+	}
+#endif	/* SIMD_KERNELS */
+	default:
+		do {
+			asm volatile ("pause");
+			rdtsc(now);
+		} while (now < deadline);
+		break;
+	}
+}
+
+/*!
+ * \brief Map C-state exit latency by idling for increasing durations
+ * \param name Idle method sleep, spin, or umwait
+ * \return Exit status
+ *
+ * After each idle, lateness is how long past the deadline the first
+ * timestamp was taken, and recovery is how long it then took to get a
+ * block of timestamps with no delta above the knee, while caches, TLBs,
+ * and clocks warm back up.
+ * Wakeups with no clean block within CSTATE_RECOVER_BLOCKS are counted as
+ * unrecovered and sort after all others.
+ * Changes in cpuidle usage counts show which C-states each duration used.
+ */
+int
+cstate_probe(const char *name) {
+	static const double idle_us[] = {1, 2, 5, 10, 20, 50, 100, 200, 500,
+	    1000, 2000, 5000, 10000, 20000, 50000, 100000};
+	static const char *methods[] = {"sleep", "spin", "umwait"};
+	uint64_t before[CSTATE_MAX], after[CSTATE_MAX];
+	double late[CSTATE_REPS], recover[CSTATE_REPS];
+	char state[CSTATE_MAX][16], limit[16];
+	unsigned lat[CSTATE_MAX];
+	uint64_t t0, t1, deadline, ticks, block_max, used;
+	int cpu, method, states, deepest = -1, top, unrecovered, i, j, k;
+	size_t d;
+	double tpns;
+
+	for (method=0; method<(int)ARRAY_SIZE(methods); method++) {
+		if (strcmp(name, methods[method]) == 0)
+			break;
+	}
+	if (method == (int)ARRAY_SIZE(methods)) {
+		fprintf(stderr, "C-state idle method (%s) must be sleep, spin, or umwait\n", name);
+		return (1);
+	}
+	if (method == CSTATE_UMWAIT) {
+		uint32_t r[4];
+
+		cpuid(0, 0, r);
+		if (r[0] >= 7)
+			cpuid(7, 0, r);
+		else
+			r[2] = 0;
+#ifndef	SIMD_KERNELS
+		r[2] = 0;	/* umwait is only built with GCC on x86 */
+#endif	/* SIMD_KERNELS */
+		/* WAITPKG */
+		if (!(r[2] & (1U<<5))) {
+			fprintf(stderr, "umwait is not supported by this CPU\n");
+			return (1);
+		}
+	}
+
+#ifdef	__linux__
+	cpu = sched_getcpu();
+#else	/* __linux__ */
+	cpu = 0;
+#endif	/* __linux__ */
+	tpns = tsc_calibrate(CALIBRATE_MS);
+	states = cpuidle_read(cpu, before, state, lat);
+	printf("C-state probe           : CPU %d, %s, %d wakeups per duration\n",
+	    cpu, methods[method], CSTATE_REPS);
+	if (states == 0) {
+		printf("cpuidle states          : not available\n");
+	} else {
+		printf("cpuidle states          :");
+		for (k=0; k<states; k++)
+			printf(" %s (%uus)", state[k], lat[k]);
+		printf("\n");
+	}
+
+	snprintf(limit, sizeof(limit), ">%dk blk", CSTATE_RECOVER_BLOCKS/1000);
+	printf("\n%-8s %-10s %-10s %-10s %-7s %s\n", "Idle", "Late med", "Late max",
+	    "Recovery", "Unrecov", "Most used C-state");
+	for (d=0; d<ARRAY_SIZE(idle_us); d++) {
+		ticks = (uint64_t)(idle_us[d]*1E3*tpns);
+		cpuidle_read(cpu, before, NULL, NULL);
+		for (i=0, unrecovered=0; i<CSTATE_REPS; i++) {
+			rdtsc(t0);
+			deadline = t0+ticks;
+			cstate_idle(method, deadline, (uint64_t)(idle_us[d]*1E3));
+			rdtsc(t1);
+			late[i] = (t1 > deadline) ? t1-deadline : 0;
+
+			/* Take blocks until one is clean */
+			for (j=0; j<CSTATE_RECOVER_BLOCKS; j++) {
+				uint64_t ts[BLOCK_DELTAS+1];
+
+				for (k=0; k<=BLOCK_DELTAS; k++)
+					rdtsc(ts[k]);
+				for (k=0, block_max=0; k<BLOCK_DELTAS; k++) {
+					if (ts[k+1]-ts[k] > block_max)
+						block_max = ts[k+1]-ts[k];
+				}
+				if (block_max <= args.knee)
+					break;
+			}
+			rdtsc(t0);
+			if (j == CSTATE_RECOVER_BLOCKS) {
+				recover[i] = HUGE_VAL;
+				unrecovered++;
+			} else {
+				recover[i] = t0-t1;
+			}
+		}
+		qsort(late, CSTATE_REPS, sizeof(late[0]), dbl_cmp);
+		qsort(recover, CSTATE_REPS, sizeof(recover[0]), dbl_cmp);
+		printf("%-8s %-10s %-10s %-10s %-7d ", t2ts((uint64_t)(idle_us[d]*1E3), 1.0),
+		    t2ts((uint64_t)late[CSTATE_REPS/2], tpns),
+		    t2ts((uint64_t)late[CSTATE_REPS-1], tpns),
+		    (recover[CSTATE_REPS/2] == HUGE_VAL) ? limit :
+		    t2ts((uint64_t)recover[CSTATE_REPS/2], tpns), unrecovered);
+
+		/* Attribute to the state entered most often */
+		if (states!=0 && cpuidle_read(cpu, after, NULL, NULL)==states) {
+			for (k=0, used=0, top=0; k<states; k++) {
+				used += after[k]-before[k];
+				if (after[k]-before[k] > after[top]-before[top])
+					top = k;
+			}
+			if (used != 0) {
+				printf("%s (%.0f%% of %" PRIu64 " entries)\n", state[top],
+				    100.0*(after[top]-before[top])/used, used);
+				for (k=states-1; k>deepest; k--) {
+					if (after[k] != before[k]) {
+						deepest = k;
+						break;
+					}
+				}
+			} else {
+				printf("none entered\n");
+			}
+		} else {
+			printf("n/a\n");
+		}
+		fflush(stdout);
+	}
+	if (deepest >= 0) {
+		printf("\nDeepest C-state entered : %s, declared exit latency %uus\n",
+		    state[deepest], lat[deepest]);
+	}
+	return (0);
+}
+#endif	/* _WIN32 */
+
+#ifdef	CPU_AFFINITY
+/*! Type for what a scan found on one CPU */
+typedef struct scan_stct {
+/*! CPU number */
+	int cpu;
+/*! Physical package (socket) of CPU */
+	int socket;
+/*! Core of CPU within its socket */
+	int core;
+/*! SMT siblings of CPU, including itself, as a CPU list */
+	char siblings[32];
+/*! 99.99th percentile, upper bound of its bin (ticks) */
+	uint64_t p9999;
+/*! Largest delta (ticks) */
+	uint64_t max;
+/*! Ticks stolen by outliers in excess of the minimum delta */
+	uint64_t stolen;
+/*! Ticks spent measuring */
+	uint64_t run_ticks;
+} scan_t;
+
+/*!
+ * \brief Read a topology attribute of a CPU
+ * \param cpu  CPU number
+ * \param what Attribute, like "core_id"
+ * \param buf  Buffer to receive the value without its newline
+ * \param len  Length of buf (bytes)
+ * \return 0 if read, -1 otherwise
+ */
+int
+topo_read(int cpu, const char *what, char *buf, size_t len) {
+	char path[96], *text;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s",
+	    cpu, what);
+	if ((text=file_read(path)) == NULL) {
+		snprintf(buf, len, "?");
+		return (-1);
+	}
+	snprintf(buf, len, "%.*s", (int)strcspn(text, "\n"), text);
+	free(text);
+	return (0);
+}
+
+/*! \brief qsort() comparison ranking quietest CPUs first */
+int
+scan_cmp(const void *a, const void *b) {
+	const scan_t *sa = a, *sb = b;
+	/* Cross multiply stolen fractions in doubles, ticks squared overflow 64 bits */
+	double fa = (double)sa->stolen*sb->run_ticks, fb = (double)sb->stolen*sa->run_ticks;
+
+	if (sa->p9999 != sb->p9999)
+		return ((sa->p9999 < sb->p9999) ? -1 : 1);
+	if (sa->max != sb->max)
+		return ((sa->max < sb->max) ? -1 : 1);
+	if (fa != fb)
+		return ((fa < fb) ? -1 : 1);
+	return (sa->cpu - sb->cpu);
+}
+
+/*!
+ * \brief Measure every online CPU in turn and rank them by jitter
+ * \param analyze_block Analysis kernel
+ * \return Exit status
+ *
+ * CPUs are limited to those in the affinity mask, so -c picks which to
+ * scan, and each is measured for the runtime set with -r.
+ * CPUs are measured one at a time since CPUs sharing caches and memory
+ * disturb each other, and all bin into the one histogram.
+ */
+int
+scan(block_fn_t analyze_block) {
+	cpu_set_t allowed, online, one;
+	uint64_t deltas[BLOCK_DELTAS];
+	uint64_t t0, t10, start, ticks;
+	scan_t *scans, *sp;
+	results_t r;
+	char buf[32], *text;
+	double tpns;
+	int cpu, n = 0;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+		perror("sched_getaffinity");
+		return (1);
+	}
+	online = allowed;
+	if ((text=file_read("/sys/devices/system/cpu/online")) != NULL) {
+		text[strcspn(text, "\n")] = '\0';
+		if (cpulist_parse(text, &online) != 0)
+			online = allowed;
+		free(text);
+	}
+	CPU_AND(&online, &online, &allowed);
+	if ((scans=calloc(CPU_COUNT(&online), sizeof(scan_t))) == NULL) {
+		fprintf(stderr, "Couldn't allocate memory for scan\n");
+		return (1);
+	}
+
+	tpns = tsc_calibrate(CALIBRATE_MS);
+	ticks = (uint64_t)(args.runtime*1E9*tpns);
+	printf("Scanning %d CPUs for %ds each\n", CPU_COUNT(&online), args.runtime);
+	for (cpu=0; cpu<CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, &online))
+			continue;
+		CPU_ZERO(&one);
+		CPU_SET(cpu, &one);
+		if (sched_setaffinity(0, sizeof(one), &one) != 0) {
+			printf("CPU %d skipped, %s\n", cpu, strerror(errno));
+			continue;
+		}
+
+		memset(&r, 0, sizeof(r));
+		r.stats.min = UINT64_MAX;
+		for (size_t i=0; i<args.bins; i++) {
+			histo[i].delta_count = 0;
+			histo[i].delta_sum   = 0;
+		}
+
+		/* Same block of timestamps as main(), without the extras */
+		rdtsc(start);
+		do {
+			ts_block(deltas, t0, t10, (void)0);
+			analyze_block(deltas, &r.stats);
+		} while (t10-start < ticks);
+		(void)t0;
+
+		sp = &scans[n++];
+		r.histo = histo;
+		r.bins = args.bins;
+		r.tpns = tpns;
+		r.run_ticks = t10-start;
+		sp->cpu = cpu;
+		sp->p9999 = histo_percentile(&r, 99.99);
+		sp->max = r.stats.max;
+		sp->stolen = histo_stolen(&r);
+		sp->run_ticks = r.run_ticks;
+		topo_read(cpu, "physical_package_id", buf, sizeof(buf));
+		sp->socket = atoi(buf);
+		topo_read(cpu, "core_id", buf, sizeof(buf));
+		sp->core = atoi(buf);
+		topo_read(cpu, "thread_siblings_list", sp->siblings, sizeof(sp->siblings));
+	}
+	sched_setaffinity(0, sizeof(allowed), &allowed);
+
+	qsort(scans, n, sizeof(scan_t), scan_cmp);
+	printf("\n%-5s %-5s %-7s %-5s %-12s %-8s %-8s %s\n", "Rank", "CPU",
+	    "Socket", "Core", "Siblings", "99.99%", "Max", "Stolen");
+	for (sp=scans; sp<scans+n; sp++) {
+		printf("%-5d %-5d %-7d %-5d %-12s %-8s %-8s %s (%.4f%%)\n",
+		    (int)(sp-scans)+1, sp->cpu, sp->socket, sp->core, sp->siblings,
+		    t2ts(sp->p9999, tpns), t2ts(sp->max, tpns),
+		    t2ts(sp->stolen, tpns), 100.0*sp->stolen/sp->run_ticks);
+	}
+	free(scans);
+	return (0);
+}
+#endif	/* CPU_AFFINITY */
+
+#ifdef	TSC_REPLAY
+/*!
+ * \brief Load the replayed timestamp source
+ *
+ * SLJTEST_TSC in the environment names a trace file written by --trace,
+ * or a synthetic stream shape from --selftest-bench, heavy-tailed by default.
+ * Trace files carry the ticks per nanosecond they were recorded with.
+ */
+void
+tsc_replay_open() {
+	const char *src = getenv("SLJTEST_TSC");
+	trace_hdr_t hdr;
+	uint64_t n, dropped, *dp;
+	FILE *fp;
+	int shape, rc;
+
+	if (src == NULL)
+		src = bench_shapes[1];
+	for (shape=0; shape<(int)ARRAY_SIZE(bench_shapes); shape++) {
+		if (strcmp(src, bench_shapes[shape]) == 0)
+			break;
+	}
+	if (shape < (int)ARRAY_SIZE(bench_shapes)) {
+		if ((tsc_replay.deltas=malloc(sizeof(uint64_t)*BENCH_DELTAS)) == NULL) {
+			fprintf(stderr, "Couldn't allocate memory for replayed timestamps\n");
+			exit(1);
+		}
+		bench_stream(shape, tsc_replay.deltas);
+		tsc_replay.n = BENCH_DELTAS;
+		tsc_replay.tpns = TSC_REPLAY_TPNS;
+		return;
+	}
+
+	if ((fp=trace_open(src, &hdr)) == NULL)
+		exit(1);
+	for (;;) {
+		if ((dp=realloc(tsc_replay.deltas,
+		    sizeof(uint64_t)*(tsc_replay.n+TRACE_CHUNK_DELTAS))) == NULL) {
+			fprintf(stderr, "Couldn't allocate memory for replayed timestamps\n");
+			exit(1);
+		}
+		tsc_replay.deltas = dp;
+		if ((rc=trace_read(fp, dp+tsc_replay.n, &n, &dropped)) <= 0)
+			break;
+		tsc_replay.n += n;
+	}
+	fclose(fp);
+	if (rc < 0 || tsc_replay.n == 0) {
+		fprintf(stderr, "%s: %s\n", src, (rc < 0) ? "trace is corrupt" :
+		    "trace has no deltas");
+		exit(1);
+	}
+	tsc_replay.tpns = hdr.tpns;
+}
+
+/*!
+ * \brief Advance the replayed TSC by the next delta, wrapping at the end
+ * \return Replayed TSC value
+ *
+ * Not thread safe: only the timing thread may call this, so options that
+ * start helper threads reading the TSC are rejected in this build.
+ */
+uint64_t
+tsc_replay_next() {
+	if (tsc_replay.i == tsc_replay.n) {
+		if (tsc_replay.deltas == NULL)
+			tsc_replay_open();
+		tsc_replay.i = 0;
+	}
+	return (tsc_replay.now += tsc_replay.deltas[tsc_replay.i++]);
+}
+
+/*!
+ * \brief Time of day on the replayed TSC
+ * \param tv Time of day
+ *
+ * Reading the clock takes TSC_REPLAY_TOD_TICKS without using up a delta,
+ * so waits on the time of day end without disturbing replayed deltas.
+ */
+void
+tsc_replay_tod(struct timeval *tv) {
+	uint64_t us;
+
+	if (tsc_replay.deltas == NULL)
+		tsc_replay_open();
+	tsc_replay.now += TSC_REPLAY_TOD_TICKS;
+	us = (uint64_t)(tsc_replay.now/tsc_replay.tpns/1000);
+	tv->tv_sec  = us / 1000000;
+	tv->tv_usec = us % 1000000;
+}
+#endif	/* TSC_REPLAY */
+
+#ifdef	SLJ_LIBRARY
+/*! Type for a recorder of the library API, see sljtest.h */
+struct slj_recorder_stct {
+/*! Name used in reports */
+	char name[32];
+/*! Histogram, written only by the owning thread */
+	bin_t *histo;
+/*! Sequence lock on stats, odd while the owning thread updates them */
+	uint64_t seq;
+/*! Statistics, written only by the owning thread under seq */
+	stats_t stats;
+/*! Ring of recent outliers */
+	outlier_t *ring;
+/*! Number of outliers ever put in ring */
+	uint64_t head;
+/*! TSC when recorder was created */
+	uint64_t start_tsc;
+/*! Time of day when recorder was created (microseconds) */
+	uint64_t start_us;
+/*! Next older recorder */
+	struct slj_recorder_stct *next;
+};
+
+/*! All recorders, newest first */
+static slj_recorder_t *slj_recorders;
+/*! Ticks per nanosecond calibrated by slj_init() */
+static double slj_tpns;
+
+int
+slj_init(uint64_t min, uint64_t knee, uint64_t bins, size_t outliers) {
+	/* Same checks as the command line */
+	if (knee <= min || bins < 2 || knee-min < bins/2)
+		return (-1);
+	args.min = min;
+	args.knee = knee;
+	args.bins = bins;
+	args.outbuf = outliers;
+	snprintf(cmdline, sizeof(cmdline), "libsljtest");
+	if (histo_setup() != 0)	/* Bin bounds shared by all recorders */
+		return (-1);
+	slj_tpns = tsc_calibrate(CALIBRATE_MS);
+	return (0);
+}
+
+slj_recorder_t *
+slj_recorder_new(const char *name) {
+	slj_recorder_t *rp;
+	struct timeval tv;
+	uint64_t i;
+
+	if ((rp=calloc(1, sizeof(*rp))) == NULL)
+		return (NULL);
+	if ((rp->histo=calloc(args.bins, sizeof(bin_t))) == NULL ||
+	    (args.outbuf != 0 && (rp->ring=calloc(args.outbuf, sizeof(outlier_t))) == NULL)) {
+		free(rp->histo);
+		free(rp);
+		return (NULL);
+	}
+	snprintf(rp->name, sizeof(rp->name), "%s", name);
+	for (i=0; i<args.bins; i++)
+		rp->histo[i].ub = histo[i].ub;
+	rp->stats.min = UINT64_MAX;
+	rdtsc(rp->start_tsc);
+	gettimeofday(&tv, NULL);
+	rp->start_us = tv.tv_sec * 1000000UL + tv.tv_usec;
+
+	/* Push onto list of recorders without a lock */
+	rp->next = __atomic_load_n(&slj_recorders, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&slj_recorders, &rp->next, rp, 0,
+	    __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
+	return (rp);
+}
+
+void
+slj_record(slj_recorder_t *rp, uint64_t when, uint64_t delta) {
+	bin_t *bp;
+	outlier_t *op;
+
+	/* Note: no end test is needed because of infinite sentinel */
+	for (bp=rp->histo; delta>bp->ub; bp++) {}
+	/* Single writer, so plain increments stored whole for readers */
+	__atomic_store_n(&bp->delta_count, bp->delta_count+1, __ATOMIC_RELAXED);
+	__atomic_store_n(&bp->delta_sum, bp->delta_sum+delta, __ATOMIC_RELAXED);
+
+	/* Statistics don't fit one atomic store, so update them under the seqlock */
+	__atomic_store_n(&rp->seq, rp->seq+1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	if (delta < rp->stats.min)
+		rp->stats.min = delta;
+	if (delta > rp->stats.max)
+		rp->stats.max = delta;
+	rp->stats.count++;
+	rp->stats.sum += delta;
+	rp->stats.sumsq += (sumsq_t)delta*delta;
+	__atomic_store_n(&rp->seq, rp->seq+1, __ATOMIC_RELEASE);
+
+	if (delta > args.knee && rp->ring != NULL) {
+		op = &rp->ring[rp->head % args.outbuf];
+		op->when = when;
+		op->delta = delta;
+		op->pos = 0;
+		__atomic_store_n(&rp->head, rp->head+1, __ATOMIC_RELEASE);
+	}
+}
+
+size_t
+slj_outliers(const slj_recorder_t *rp, uint64_t *when, uint64_t *delta, size_t n) {
+	uint64_t head = __atomic_load_n(&rp->head, __ATOMIC_ACQUIRE), now;
+	const outlier_t *op;
+	size_t i;
+
+	if (rp->ring == NULL)
+		return (0);
+	for (i=0; i<n && i<head && i<(size_t)args.outbuf; i++) {
+		op = &rp->ring[(head-1-i) % args.outbuf];
+		when[i] = op->when;
+		delta[i] = op->delta;
+	}
+
+	/*
+	 * Outlier k shares its slot with k+outbuf, which the owner may have
+	 * been writing since it published outlier now-1, so drop the oldest
+	 * copies from slots it may have reached.
+	 */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	now = __atomic_load_n(&rp->head, __ATOMIC_RELAXED);
+	while (i > 0 && head-i+args.outbuf <= now)
+		i--;
+	return (i);
+}
+
+/*!
+ * \brief Copy a recorder's statistics consistently while its owner may be recording
+ * \param rp Recorder
+ * \param sp Statistics to fill
+ */
+static void
+slj_stats(const slj_recorder_t *rp, stats_t *sp) {
+	uint64_t seq;
+
+	for (;;) {
+		seq = __atomic_load_n(&rp->seq, __ATOMIC_ACQUIRE);
+		if (!(seq&1)) {
+			memcpy(sp, &rp->stats, sizeof(*sp));
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&rp->seq, __ATOMIC_RELAXED) == seq)
+				return;
 		}
+		asm volatile ("pause");
 	}
-	return (0);
 }
 
-/*! \brief Allocate memory and open file for outliers logging
+/*!
+ * \brief Snapshot one recorder or all recorders merged as results
+ * \param rp       Recorder, or NULL for all
+ * \param res      Results to fill
+ * \param start_us Receives time of day the earliest recorder was created
+ * \return 0 if there is anything to report, -1 otherwise
+ *
+ * Histogram counts are read while owners may be recording, so they can
+ * be off from the statistics by the few sections recorded during the
+ * snapshot.
  */
-void
-outliers_setup() {
-	if ((outbuf=(outlier_t *)calloc(args.outbuf, sizeof(outlier_t))) == NULL) {
-		fprintf(stderr, "Couldn't allocate memory for outlier buffer\n");
-		exit(1);
+static int
+slj_results(const slj_recorder_t *rp, results_t *res, uint64_t *start_us) {
+	const slj_recorder_t *r;
+	uint64_t i, start_tsc = UINT64_MAX, now;
+	struct timeval tv;
+	stats_t st;
+
+	memset(res, 0, sizeof(*res));
+	if ((res->histo=calloc(args.bins, sizeof(bin_t))) == NULL)
+		return (-1);
+	res->bins = args.bins;
+	res->tpns = slj_tpns;
+	res->stats.min = UINT64_MAX;
+	*start_us = UINT64_MAX;
+	for (i=0; i<args.bins; i++)
+		res->histo[i].ub = histo[i].ub;
+	for (r=(rp != NULL) ? rp : __atomic_load_n(&slj_recorders, __ATOMIC_ACQUIRE);
+	    r!=NULL; r=(rp != NULL) ? NULL : r->next) {
+		for (i=0; i<args.bins; i++) {
+			res->histo[i].delta_count += __atomic_load_n(&r->histo[i].delta_count, __ATOMIC_RELAXED);
+			res->histo[i].delta_sum   += __atomic_load_n(&r->histo[i].delta_sum,   __ATOMIC_RELAXED);
+		}
+		slj_stats(r, &st);
+		stats_merge(&res->stats, &st);
+		if (r->start_tsc < start_tsc) {
+			start_tsc = r->start_tsc;
+			*start_us = r->start_us;
+		}
 	}
-	if ((outfile=fopen(args.outfile, "w")) == NULL) {
-		fprintf(stderr, "Unable to create outliers file %s\n",
-		    args.outfile);
-		perror(args.outfile);
-		exit(1);
+	if (res->stats.count == 0) {
+		free(res->histo);
+		return (-1);
 	}
+	rdtsc(now);
+	gettimeofday(&tv, NULL);
+	res->run_ticks = now-start_tsc;
+	res->run_us = tv.tv_sec * 1000000UL + tv.tv_usec - *start_us;
+	res->timing_ticks = res->stats.sum;	/* Time spent in sections */
+	return (0);
 }
 
 void
-histo_setup() {
-	bin_t *bp;
-
-	/* Allocate memory for histogram */
-	if ((histo=(bin_t *)malloc(sizeof(bin_t)*args.bins)) == NULL) {
-		fprintf(stderr, "Couldn't allocate memory for histogram bins\n");
-		exit(1);
-	}
+slj_report(const slj_recorder_t *rp) {
+	results_t res;
+	uint64_t start_us;
 
-	/*
-	 * Fill first half of histogram table with values up to knee.
-	 * Evenly divide upper bound values through knee among bins.
-	 */
-	for (bp=histo; bp<histo+(args.bins/2); bp++) {
-		bp->ub = args.min+(args.knee-args.min)*(bp-histo+1)/(args.bins/2);
-		bp->delta_count = 0;
-		bp->delta_sum   = 0;
+	if (slj_results(rp, &res, &start_us) != 0) {
+		printf("No sections recorded%s%s\n", rp ? " by " : "", rp ? rp->name : "");
+		return;
 	}
-	/* Fill second half of histogram table with values above knee */
-	/* Advance each bin upper bound by 1/2 an order of magnitude */
-	uint64_t mult = args.knee;
-	for (        ; bp<histo+args.bins; bp++) {
-		bp->ub = mult*2;
-		bp->delta_count = 0;
-		bp->delta_sum   = 0;
-		bp++;
+	if (rp != NULL)
+		printf("Recorder                : %s\n", rp->name);
+	histo_print(&res);
+	stats_print(&res);
+	free(res.histo);
+}
 
-		mult *= 10;
-		bp->ub = mult;
-		bp->delta_count = 0;
-		bp->delta_sum   = 0;
-	}
-	histo[args.bins-1].ub = UINT64_MAX;	/* Sentinel */
+int
+slj_save(const slj_recorder_t *rp, const char *path) {
+	results_t res;
+	uint64_t start_us;
+	int rc;
+
+	if (slj_results(rp, &res, &start_us) != 0)
+		return (-1);
+	rc = snap_save(path, &res, start_us);
+	free(res.histo);
+	return (rc);
 }
+#else	/* SLJ_LIBRARY */
 
 /*!
  * \brief Measure and visualize system latency jitter.
@@ -451,19 +6773,20 @@ main(int argc, char *argv[]) {
 	int errflag;
 	uint64_t start_us, stop_us, now_us; /* Start, stop, and time now in microseconds */
 	uint64_t start_tsc, stop_tsc;	/* Start and stop in TSC ticks */
-	bin_t *bp;
-	uint64_t deltas[10], *dp;
-	uint64_t min, max;		/* Min and max deltas (ticks) */
+	uint64_t deltas[BLOCK_DELTAS];
+	stats_t stats;			/* Statistics over all deltas */
+	block_fn_t analyze_block;	/* Analysis kernel for each block */
+	uint32_t outmask;		/* Mask of deltas in block above knee */
 	struct timeval now_gtod;	/* Time now as timeval */
-	/* The following two headers are assumed to have the same string length */
-	const char *cnt_graph_hdr = "Time    Ticks    Count        Percent    Cumulative  ";
-	const char *sum_graph_hdr = "Time    Ticks    Sum          Percent    Cumulative  ";
-	const char *graph_str = "*******************************************************************";
-	outlier_t *obp;		/* Pointer to next open entry in outlier buffer */
-	int didwrap;		/* True when outlier buffer wrapped around */
 
 	errflag = args_parse(argc, argv);
 
+	/* Remember command line for snapshots */
+	for (int i=0; i<argc; i++) {
+		size_t used = strlen(cmdline);
+		snprintf(cmdline+used, sizeof(cmdline)-used, "%s%s", i ? " " : "", argv[i]);
+	}
+
 	/* Argument validity checks */
 	if (args.knee <= args.min) {
 		fprintf(stderr, "Min (%" PRIu64
@@ -488,21 +6811,168 @@ main(int argc, char *argv[]) {
 		errflag++;
 	}
 
+	if ((analyze_block=block_select(args.kernel)) == NULL) {
+		fprintf(stderr, "Analysis kernel (%s) must be scalar, avx2, or avx512"
+		    " and supported by this CPU\n", args.kernel);
+		errflag++;
+	}
+	if (args.trigger != 0 && args.trigger <= args.knee) {
+		fprintf(stderr, "Trigger (%" PRIu64 ") must be > knee (%" PRIu64 ")\n",
+		    args.trigger, args.knee);
+		errflag++;
+	}
+	if (args.interval < 0 || (args.interval > 0 && args.pause != 0)) {
+		fprintf(stderr, "Interval (%g) must be > 0 and can't be used with pause\n",
+		    args.interval);
+		errflag++;
+	}
+	if (args.correct && args.pause == 0 && args.interval <= 0) {
+		fprintf(stderr, "Coordinated omission correction needs -p or --interval\n");
+		errflag++;
+	}
+#ifdef	TSC_REPLAY
+	/* Only the timing thread may read the replayed TSC, and the host isn't replayed */
+	if (args.live || args.freq != NULL || args.trigger != 0 || args.audit ||
+	    args.scan || args.cstates != NULL || args.work != NULL) {
+		fprintf(stderr, "--live, --freq, --trigger, --audit, --scan, --cstates,"
+		    " and --work can't be used with a replayed TSC\n");
+		errflag++;
+	}
+#endif	/* TSC_REPLAY */
+	/* Linux takes a timer slack of 0 to mean the default, usually 50 us */
+	if (args.slack == 0) {
+		fprintf(stderr, "Timer slack (%ld) must be >= 1ns\n", args.slack);
+		errflag++;
+	}
+	if (args.sched != NULL && strcmp(args.sched, "fifo") != 0 &&
+	    strcmp(args.sched, "rr") != 0 && strcmp(args.sched, "other") != 0) {
+		fprintf(stderr, "Scheduling policy (%s) must be fifo, rr, or other\n",
+		    args.sched);
+		errflag++;
+	}
+	/* A real-time policy wants locked memory and minimal timer slack too */
+	if (args.sched != NULL && strcmp(args.sched, "other") != 0) {
+		args.lock = 1;
+		if (args.slack < 0)
+			args.slack = 1;
+	}
+
 	if (errflag) {
 		fprintf(stderr, "%s\n%s %s\n", version, argv[0], usage);
 		exit(1);
 	}
 
+	if (args.load != NULL)
+		return (snap_report(args.load));
+
+	if (args.replay != NULL) {
+#ifndef _WIN32
+		return (replay(args.replay));
+#else	/* _WIN32 */
+		fprintf(stderr, "Replay is not supported on this platform\n");
+		return (1);
+#endif	/* _WIN32 */
+	}
+
+	if (args.aggregate != NULL) {
+#ifndef _WIN32
+		return (aggregate(args.aggregate));
+#else	/* _WIN32 */
+		fprintf(stderr, "Aggregation is not supported on this platform\n");
+		return (1);
+#endif	/* _WIN32 */
+	}
+
+	if (args.dump_trace != NULL) {
+#ifndef _WIN32
+		return (dump_trace(args.dump_trace));
+#else	/* _WIN32 */
+		fprintf(stderr, "Traces are not supported on this platform\n");
+		return (1);
+#endif	/* _WIN32 */
+	}
+
+	if (args.peek != NULL) {
+#ifndef _WIN32
+		return (shm_peek(args.peek));
+#else	/* _WIN32 */
+		fprintf(stderr, "Shared memory export is not supported on this platform\n");
+		return (1);
+#endif	/* _WIN32 */
+	}
+
 #ifdef	CPU_AFFINITY
 	if (args.cpu != NULL)
 		set_affinity(args.cpu);
 #endif	/* CPU_AFFINITY */
 
+	if (args.sched!=NULL || args.slack>=0)
+		sched_setup();
+
+	if (args.lock)
+		mem_lock();	/* Lock before allocating so buffers are locked too */
+
+	if (args.kernel!=NULL && !args.bench) {
+		printf("Analysis kernel         : %s\n", block_name(analyze_block));
+	}
+
+	if (args.work != NULL)
+		work_setup(args.work);	/* Set up work unit and fit histogram to it */
+
 	if (args.outfile!=NULL && args.outbuf!=0) {
 		outliers_setup();	/* Set up memory and output file for outliers */
 	}
 
-	histo_setup();		/* Set up histogram memory and data structures */
+	if (histo_setup() != 0) {	/* Set up histogram memory and data structures */
+		fprintf(stderr, "Couldn't allocate memory for histogram bins\n");
+		exit(1);
+	}
+	events_setup();		/* Set up event merging */
+
+	if (args.bench)
+		return (bench(analyze_block));
+
+	if (args.scan) {
+#ifdef	CPU_AFFINITY
+		return (scan(analyze_block));
+#else	/* CPU_AFFINITY */
+		fprintf(stderr, "Scanning CPUs is not supported on this platform\n");
+		return (1);
+#endif	/* CPU_AFFINITY */
+	}
+
+	if (args.cstates != NULL) {
+#ifndef _WIN32
+		return (cstate_probe(args.cstates));
+#else	/* _WIN32 */
+		fprintf(stderr, "C-state probe is not supported on this platform\n");
+		return (1);
+#endif	/* _WIN32 */
+	}
+
+	if (args.trace != NULL) {
+#ifndef _WIN32
+		trace_setup();	/* Set up trace ring and start writer thread */
+#else	/* _WIN32 */
+		fprintf(stderr, "Traces are not supported on this platform\n");
+		exit(1);
+#endif	/* _WIN32 */
+	}
+
+	/* Calibrate once so every feature converts times the same way */
+	double cal_tpns = 0;
+	if (args.trigger != 0 || args.series != NULL || args.live ||
+	    args.interval > 0 || args.correct || args.shm != NULL || args.freq != NULL)
+		cal_tpns = tsc_calibrate(CALIBRATE_MS);
+
+	if (args.trigger != 0) {
+#ifndef _WIN32
+		fr_setup(cal_tpns);	/* Set up flight recorder and start its helper thread */
+#else	/* _WIN32 */
+		fprintf(stderr, "Flight recorder is not supported on this platform\n");
+		exit(1);
+#endif	/* _WIN32 */
+	}
 
 	/*
 	 * XXX Note that it might get much eaiser to modularize this if in the
@@ -510,238 +6980,234 @@ main(int argc, char *argv[]) {
 	 */
 
 	uint64_t timing_ticks = 0;	/* TSC ticks actually spent in timing measurements */
-	uint64_t delta_count = 0;	/* Global count of deltas taken */
-	uint64_t delta_sum = 0;		/* Global sum of TSC deltas measured */
-	min   = UINT64_MAX;
-	max   = 0;
+	memset(&stats, 0, sizeof(stats));
+	stats.min = UINT64_MAX;
+
+	if (args.series != NULL)
+		roll_setup(&stats, cal_tpns);	/* Set up rollup rings */
+
+	char *audit = NULL;	/* Isolation audit report */
+	if (args.audit) {
+#ifdef	CPU_AFFINITY
+		audit = audit_collect();	/* Inspect now, report with results */
+#else	/* CPU_AFFINITY */
+		fprintf(stderr, "Isolation audit is not supported on this platform\n");
+		exit(1);
+#endif	/* CPU_AFFINITY */
+	}
+
+	if (args.live) {
+#ifndef _WIN32
+		live_setup(&stats, cal_tpns);	/* Start render thread */
+#else	/* _WIN32 */
+		fprintf(stderr, "Live display is not supported on this platform\n");
+		exit(1);
+#endif	/* _WIN32 */
+	}
+
+	if (args.interval > 0)
+		pace_setup(cal_tpns);	/* Set up block deadlines */
+
+	if (args.correct) {
+		/* Expect blocks every interval, or every pause */
+		co_setup((pace.ticks != 0) ? pace.ticks :
+		    (uint64_t)(args.pause*1E6*cal_tpns));
+	}
+
+	if (args.shm != NULL) {
+#ifndef _WIN32
+		shm_setup(args.shm, &stats, cal_tpns);	/* Create and map export segment */
+#else	/* _WIN32 */
+		fprintf(stderr, "Shared memory export is not supported on this platform\n");
+		exit(1);
+#endif	/* _WIN32 */
+	}
+
+	if (args.freq != NULL) {
+#ifdef	__linux__
+		freq_setup(cal_tpns);	/* Start frequency sampler thread */
+#else	/* __linux__ */
+		fprintf(stderr, "Frequency monitoring is not supported on this platform\n");
+		exit(1);
+#endif	/* __linux__ */
+	}
 
 	obp = outbuf;
 	didwrap = 0;
 
-	/*
-	 * Variables for computing average and standard deviation.
-	 * See http://en.wikipedia.org/wiki/Algorithms_for_calculating_variance#On-line_algorithm
-	 */
-	double avg = 0.0;	/* Average delta (ticks) */
-	double last_avg;	/* Last average (needed for deviation */
-	double svn = 0.0;	/* Standard Variance Numerator */
+#ifndef _WIN32
+	/* Count page faults taken while timing so they aren't mistaken for jitter */
+#ifdef	RUSAGE_THREAD
+	const int ru_who = RUSAGE_THREAD;
+#else	/* RUSAGE_THREAD */
+	const int ru_who = RUSAGE_SELF;
+#endif	/* RUSAGE_THREAD */
+	struct rusage ru_start, ru_stop;
+	getrusage(ru_who, &ru_start);
+#endif	/* _WIN32 */
+#ifdef	__linux__
+	cpu_set_t steal_set;	/* Measured CPUs */
+	double steal = (steal_cpus(&steal_set) == 0) ?
+	    steal_ms(&steal_set) : -1;	/* Steal time so far, then during test */
+#else	/* __linux__ */
+	double steal = -1;
+#endif	/* __linux__ */
 
 	rdtsc(start_tsc);
+#ifndef _WIN32
+	fr.start_tsc = start_tsc;
+#endif	/* _WIN32 */
+	if (rollup.ticks != 0)
+		roll_start(start_tsc);
+	pace.next = start_tsc;
+#ifndef _WIN32
+	if (shm.ticks != 0)
+		shm_start(start_tsc);
+#endif	/* _WIN32 */
 	gettimeofday(&now_gtod, NULL);
 	start_us = now_gtod.tv_sec * 1000000UL + now_gtod.tv_usec;
 	stop_us = start_us + 1000000UL*args.runtime;
 
 	do {
-		dp = deltas;
-
 		if (args.pause)
 			SLEEP_MSEC(args.pause);
+		else if (pace.ticks != 0)
+			pace_wait();
 
-		register uint64_t t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10;
+		register uint64_t t0, t10;
 
-		/*
-		 * Take a block of 11 timestamps and compute their differences into
-		 * a 10-element array.
-		 */
-		/* Do an "unrolled loop" so there's no branching or other work */
-		rdtsc(t0);
-		rdtsc(t1);
-		rdtsc(t2);
-		rdtsc(t3);
-		rdtsc(t4);
-		rdtsc(t5);
-		rdtsc(t6);
-		rdtsc(t7);
-		rdtsc(t8);
-		rdtsc(t9);
-		rdtsc(t10);
-		*dp++ = t1 -t0;
-		*dp++ = t2 -t1;
-		*dp++ = t3 -t2;
-		*dp++ = t4 -t3;
-		*dp++ = t5 -t4;
-		*dp++ = t6 -t5;
-		*dp++ = t7 -t6;
-		*dp++ = t8 -t7;
-		*dp++ = t9 -t8;
-		*dp++ = t10-t9;
+		if (work.fn == NULL)
+			ts_block(deltas, t0, t10, (void)0);
+		else	/* Each delta times one unit of work */
+			ts_block(deltas, t0, t10, work.fn());
 
 		timing_ticks += t10-t0;
 
-		/*
-		 * Now that we're out of the timing loop, we can take all the
-		 * CPU we need for analysis.
-		 */
-		for (dp=deltas; dp<deltas+ARRAY_SIZE(deltas); dp++) {
-			if (*dp < min)
-				min   = *dp;
-			if (*dp > max)
-				max   = *dp;
-
-			/* Find bin to count this delta */
-			/* Note: no end test is needed because of infinite sentinel */
-			for (bp=histo; *dp>bp->ub; bp++) {}
-
-			bp->delta_count++;
-			bp->delta_sum += *dp;
-
-			delta_count++;
-			delta_sum += *dp;
-
-			last_avg = avg;
-			avg += ((double)*dp-avg)/delta_count;
-			svn += ((double)*dp-avg)*((double)*dp-last_avg);
-
-			/* If an outlier should be recorded */
-			if (outbuf!=NULL && *dp>args.knee) {
-				/* Assume it happened in middle of block */
-				obp->when = t5;
-				obp->delta = *dp;
-				obp++;
-				/* Wrap around if needed */
-				if (obp-outbuf >= args.outbuf) {
-					obp = outbuf;
-					didwrap = 1;
-				}
-			}
-		}
-		rdtsc(stop_tsc);
-		gettimeofday(&now_gtod, NULL);
-		now_us = now_gtod.tv_sec * 1000000UL + now_gtod.tv_usec;
-
-	} while (now_us < stop_us);
-
-	/* Compute Ticks Per NanoSecond for duration of test */
-	double tpns = (stop_tsc-start_tsc)/1000.0/(stop_us-start_us);
-
-	/* Print histogram headers */
-	printf("%sGraph ln(Count-e)\n", (args.sum) ? sum_graph_hdr : cnt_graph_hdr);
-
-	/* Find maximum delta count and sum in any histogram bin for scaling graph */
-	uint64_t max_count=0, max_sum=0;
-	for (bp=histo; bp<histo+args.bins; bp++) {
-		if (bp->delta_count > max_count)
-			max_count = bp->delta_count;
-		if (bp->delta_sum   > max_sum  )
-			max_sum   = bp->delta_sum  ;
-	}
-
-	/* Find a graph scaling value so that the maximum bin is full line width */
-	double graph_scale;
-	if (args.sum) {
-		graph_scale = (double)(args.linewid-strlen(cnt_graph_hdr))/log(((double)max_sum  )-M_E);
-	} else {
-		graph_scale = (double)(args.linewid-strlen(cnt_graph_hdr))/log(((double)max_count)-M_E);
-	}
-
-	/* Print histogram */
-	uint64_t c_count = 0;	/* Cumulative delta count as we step through bins */
-	uint64_t mid_count = 0;	/* Cumulative delta count at histogram midpoint */
-	uint64_t c_sum = 0;	/* Cumulative delta sum   as we step through bins */
-	uint64_t mid_sum = 0;	/* Cumulative delta sum   at histogram midpoint */
-	for (bp=histo; bp<histo+args.bins; bp++) {
-		/*
-		 * If at midpoint in histogram, record c_count for
-		 * knee tuning advice later.
-		 */
-		if (bp == histo+(args.bins/2)) {
-			mid_count = c_count;
-			mid_sum = c_sum;
+#ifndef _WIN32
+		/* Copy raw deltas for the trace writer; only a full chunk costs more */
+		if (trace.pos != NULL) {
+			memcpy(trace.pos, deltas, sizeof(deltas));
+			if ((trace.pos += BLOCK_DELTAS) == trace.end)
+				trace_publish();
 		}
 
-		c_count += bp->delta_count;
-		c_sum   += bp->delta_sum;
-
-		/* Format bin upper bound nicely into ub_str */
-		char *ub_str, ubbuf[99];
-		if (bp->ub == UINT64_MAX)
-			ub_str = "Infinite";
-		else {
-			sprintf(ubbuf, "%-8" PRIu64, bp->ub);
-			ub_str = ubbuf;
+		/* Keep recent deltas for the flight recorder */
+		if (fr.ring != NULL) {
+			memcpy(fr.wp, deltas, sizeof(deltas));
+			if ((fr.wp += BLOCK_DELTAS) == fr.ring+fr.len)
+				fr.wp = fr.ring;
+			fr.count += BLOCK_DELTAS;
+			if (fr.filling != NULL && fr.count >= fr.until)
+				fr_complete();
 		}
+#endif	/* _WIN32 */
 
 		/*
-		 * Compute a logrithmic function on bin delta count or sum
-		 * that looks good.
+		 * Now that we're out of the timing loop, we can take all the
+		 * CPU we need for analysis.
 		 */
-		int graphwid;
-		if (args.sum) {
-			graphwid = graph_scale*log(((double)bp->delta_sum  )-M_E);
-		} else {
-			graphwid = graph_scale*log(((double)bp->delta_count)-M_E);
-		}
+		outmask = analyze_block(deltas, &stats);
+		outliers_walk(deltas, outmask, t0);
 
-		if (graphwid < 0)
-			graphwid = 0;
-		/*
-		 * Any nonzero delta count deserves a star, even though floating
-		 * point sometimes rounds down to zero stars.
-		 */
-		if (graphwid==0 && bp->delta_count!=0)
-			graphwid = 1;
+		/* Close rollup windows once their deadline passes */
+		if (rollup.ticks!=0 && t10>=rollup.deadline)
+			roll_tick(t10);
 
-		/* Print a row for each bin */
-		if (args.sum) {
-			printf("%s  %s %-12" PRIu64 " %7.4f%%  %8.4f%%    %*.*s\n",
-			    t2ts(bp->ub, tpns), ub_str, bp->delta_sum,
-			    100.0*bp->delta_sum/delta_sum, 100.0*c_sum/delta_sum,
-			    graphwid, graphwid, graph_str);
-		} else {
-			printf("%s  %s %-12" PRIu64 " %7.4f%%  %8.4f%%    %*.*s\n",
-			    t2ts(bp->ub, tpns), ub_str, bp->delta_count,
-			    100.0*bp->delta_count/delta_count, 100.0*c_count/delta_count,
-			    graphwid, graphwid, graph_str);
-		}
+#ifndef _WIN32
+		/* Publish to shared memory once the deadline passes */
+		if (shm.ticks!=0 && t10>=shm.deadline)
+			shm_publish(t10, timing_ticks);
+#endif	/* _WIN32 */
 
-		/* Separate lower 1/2 of histogram from upper 1/2 */
-		assert(bp-histo+1 > 0);
-		if ((unsigned)(bp-histo+1) == args.bins/2)
-			printf("\n");
-	}
+		rdtsc(stop_tsc);
+		gettimeofday(&now_gtod, NULL);
+		now_us = now_gtod.tv_sec * 1000000UL + now_gtod.tv_usec;
 
-	/*
-	 * Population variance is svn sum computed above over size of population.
-	 * Population standard deviation is square root of population variance.
-	 */
-	double std_dev = sqrt(svn/delta_count);
+	} while (now_us < stop_us);
 
-	/* Print some useful statistics */
-	printf("\nTiming was measured for %s, %5.2f%% of runtime\n",
-	    t2ts(timing_ticks, tpns), 100.0*timing_ticks/(stop_tsc-start_tsc));
-	printf("CPU speed measured  : %7.2f MHz over %" PRIu64 " iterations\n",
-	    (double)(stop_tsc-start_tsc)/(stop_us-start_us), delta_count);
-	printf("Min / Average / Std Dev / Max :   %" PRIu64 "   /   %" PRIu64 "   /  %3.0f   / %" PRIu64 " ticks\n",
-	    min, delta_sum/delta_count, std_dev, max);
-	printf("Min / Average / Std Dev / Max : %s / %s / %s / %s\n",
-	    t2ts(min, tpns), t2ts(delta_sum/delta_count, tpns),
-	    t2ts((uint64_t)std_dev, tpns), t2ts(max, tpns));
+#ifdef	__linux__
+	if (steal >= 0)
+		steal = steal_ms(&steal_set)-steal;
+#endif	/* __linux__ */
+#ifndef _WIN32
+	getrusage(ru_who, &ru_stop);
+
+	if (args.live)
+		live_finish();
+#endif	/* _WIN32 */
+#ifdef	__linux__
+	if (freq.tpns != 0)
+		freq_stop();
+#endif	/* __linux__ */
 
-	/* Analyze histogram to give advice on setting better min */
-	if (min<args.min || args.min<0.80*min) {
-		printf("Recommend min setting of %3.0f ticks\n", 0.80*min);
-	}
+	/* Compute Ticks Per NanoSecond for duration of test */
+	double tpns = (stop_tsc-start_tsc)/1000.0/(stop_us-start_us);
 
-	/* Analyze histogram to give advice on setting better knee */
-	if (args.sum) {
-		if (outbuf==NULL && 100.0*mid_sum/delta_sum<90.0) {
-			printf("Recommend increasing knee setting from %" PRIu64 " ticks\n",
-			    args.knee);
-		}
-		if (outbuf==NULL && 100.0*mid_sum/delta_sum>99.0) {
-			printf("Recommend decreasing knee setting from %" PRIu64 " ticks\n",
-			    args.knee);
-		}
-	} else {
-		if (outbuf==NULL && 100.0*mid_count/delta_count<90.0) {
-			printf("Recommend increasing knee setting from %" PRIu64 " ticks\n",
-			    args.knee);
-		}
-		if (outbuf==NULL && 100.0*mid_count/delta_count>99.0) {
-			printf("Recommend decreasing knee setting from %" PRIu64 " ticks\n",
-			    args.knee);
-		}
+	results_t results;
+	results.histo = histo;
+	results.bins = args.bins;
+	results.stats = stats;
+	results.tpns = tpns;
+	results.timing_ticks = timing_ticks;
+	results.run_ticks = stop_tsc-start_tsc;
+	results.run_us = stop_us-start_us;
+
+	if (events.cur.count != 0)
+		event_close();
+
+	histo_print(&results);
+	stats_print(&results);
+	results_t late;		/* Block start lateness with --interval */
+	if (pace.ticks != 0)
+		pace_report(tpns, &late);
+	if (co.ticks != 0)
+		co_report(&results, (pace.ticks != 0) ? &late : NULL);
+
+#if !defined(_WIN32) && !defined(TSC_REPLAY)
+	/* Page faults show up as outliers, so always mention them */
+	long minflt = ru_stop.ru_minflt-ru_start.ru_minflt;
+	long majflt = ru_stop.ru_majflt-ru_start.ru_majflt;
+	if (minflt!=0 || majflt!=0 || args.lock || args.huge) {
+		printf("Page faults during test : %ld minor, %ld major\n",
+		    minflt, majflt);
 	}
+#endif	/* _WIN32 TSC_REPLAY */
+
+#ifndef	TSC_REPLAY
+	/* Host page faults, hypervisor, and steal time don't apply to a replayed TSC */
+	hv_report(&results, steal);
+#endif	/* TSC_REPLAY */
+	if (audit != NULL)
+		printf("%s", audit);
+#ifdef	__linux__
+	if (freq.tpns != 0)
+		freq_report(start_tsc);
+#endif	/* __linux__ */
+
+#ifndef _WIN32
+
+	if (args.trace != NULL)
+		trace_finish(tpns);
+	if (fr.ring != NULL)
+		fr_finish();
+#endif	/* _WIN32 */
+
+	events_print(&results);
+	if (events.buf != NULL)
+		events_write(&results, start_tsc);
+	if (rollup.ticks != 0)
+		roll_finish(stop_tsc, start_tsc, tpns);
+#ifndef _WIN32
+	/* After rollups close their last windows, so they're published too */
+	if (shm.ticks != 0)
+		shm_finish(&results);
+#endif	/* _WIN32 */
+
+	advise(&results, outbuf!=NULL);
+
+	int status = 0;		/* Exit status, nonzero if saving failed */
+	if (args.save != NULL && snap_save(args.save, &results, start_us) != 0)
+		status = 1;
 
 	/* Dump log of outliers to outfile */
 	/* XXX Why isn't this a compound && test like the above call to outliers_setup()? */
@@ -756,14 +7222,15 @@ main(int argc, char *argv[]) {
 		for (obp=outbuf; obp<outbuf+args.outbuf; obp++) {
 			if (obp->when == 0)
 				continue;
-			fprintf(outfile, "%f, %f\n",
+			fprintf(outfile, "%f, %f, %d\n",
 			    (obp->when-start_tsc)/tpns/1000000.0,
-			    obp->delta/tpns/1000.0);
+			    obp->delta/tpns/1000.0, obp->pos);
 		}
 		fclose(outfile);
 	}
-	return (0);
+	return (status);
 }
+#endif	/* SLJ_LIBRARY */
 /**
 \mainpage System Latency Jitter Test
 \tableofcontents
@@ -936,6 +7403,41 @@ to collect the timestamps.
 Analysis work on the collected timestamps is never done while collecting,
 but only after completion of the unwound loop.
 
+The time spent on analysis is time the TSC isn't being watched, so analysis
+of each block is done by a kernel chosen at startup for the CPU.
+On CPUs with AVX2 or AVX-512, vector kernels find the block's minimum and
+maximum, compare all deltas against the knee at once to find outliers, and
+find each delta's bin by counting the bin upper bounds it exceeds with
+vector compares.
+The <tt>--kernel</tt> option forces a particular kernel for comparison.
+
+The <tt>--selftest-bench</tt> option, also run by <tt>make bench</tt>,
+measures that cost instead of testing.
+It feeds synthetic bimodal, heavy-tailed, and all-outlier delta streams
+through the kernel and the outlier walk of the timing loop, and reports
+analysis time per delta, branch misses per delta where Linux perf
+counters are available, and the duty cycle: the share of each loop
+spent taking timestamps rather than analyzing them or checking the time.
+Jitter shorter than the analysis of a block can be missed entirely, so
+a drop in duty cycle is a regression in what the test can see.
+
+Building with <tt>-DTSC_REPLAY</tt>, as <tt>make sljtest-replay</tt>
+does, replaces the TSC with a replayed one, so the histogram, statistics,
+outlier capture, and advice can be checked for correctness and speed on
+machines whose own jitter is noisy.
+The environment variable <tt>SLJTEST_TSC</tt> names a trace file written
+by <tt>--trace</tt> or one of the synthetic streams above, heavy-tailed
+by default, and its deltas are replayed in order, over and over.
+The time of day follows the replayed TSC, so a run of the same length
+on the same stream gives the same results on any machine.
+Lines describing the host rather than the stream, page faults,
+hypervisor, and steal time, are left out.
+Options that need helper threads reading the TSC or the real host,
+<tt>--live</tt>, <tt>--freq</tt>, <tt>--trigger</tt>, and
+<tt>--audit</tt>, and those timing real effects against the replayed
+clock, <tt>--scan</tt>, <tt>--cstates</tt>, and <tt>--work</tt>, are
+rejected in this build.
+
 \code
 	uint64_t deltas[10], *dp;
 
@@ -1243,6 +7745,277 @@ systems.
 In particular, the maximum and standard deviation in units of time are probably
 the two most important numbers for most Ultra Messaging customers.
 
+\subsection interruptions Interruptions
+
+One interruption often shows up as several consecutive outliers, for
+example an interrupt handler followed by cache misses while the timing
+loop warms up again.
+So outliers less than 1000 ticks apart (set with <tt>--gap</tt>) are
+merged into one event, and the rate of events is reported as
+interruptions per second.
+The time lost to an event is the sum of its outliers in excess of the
+minimum delta, and the total time lost is given as a percentage of
+runtime.
+
+A histogram of event sizes follows, using the histogram bins above the
+knee.
+Event size is the total of the event's outliers, and the Lost column is
+the time lost to events in that bin.
+With <tt>--events</tt>, the most recent events are also written to a
+file, one per line, as start time in ms relative to the start of the
+test, duration in us, number of outliers, and time lost in us.
+The outlier buffer size set with <tt>-o</tt> also sets how many events
+are kept.
+
+\subsection live Live Display
+
+The <tt>--live</tt> option redraws the histogram in place every second
+while the test runs, for immediate feedback while changing BIOS
+settings, interrupt affinity, or daemons.
+Below the histogram, which covers the run so far, is a line for the
+last second only: the largest delta, the 99.9th percentile, the time
+stolen by deltas above the knee, and the number of interruptions.
+The maximum is exact when there were outliers, otherwise it is the
+upper bound of the highest bin used.
+
+The display is drawn by a separate thread from snapshots of the
+histogram, so the timing loop does no extra work for it.
+Like the other helper threads, it runs on CPUs not being measured when
+the test is pinned with <tt>-c</tt>.
+The usual report follows when the test ends.
+
+\subsection shm Shared Memory Export
+
+The <tt>--shm name</tt> option publishes the histogram, statistics, and
+the last 64 outliers every 10 ms in a POSIX shared memory segment like
+<tt>/sljtest</tt>, so agents and viewers can watch a long run without
+sljtest doing any I/O or locking.
+Publishing is a copy between blocks, and the segment is written through
+once before the run so publishing never takes a page fault.
+<tt>sljtest --peek name</tt> reports on the segment like <tt>--load</tt>
+reports on a snapshot, followed by the recent outliers in the format of
+the <tt>-f</tt> file.
+It works during the run and after it, since the segment is left in place
+until it is removed, for example with <tt>rm /dev/shm/sljtest</tt> on Linux.
+
+Readers follow a sequence lock: read the \c seq field, copy what is
+needed, and read \c seq again.
+If it was odd or changed, the writer was publishing, so the copy is
+retried.
+Readers in other languages can use the layout of \c shm_hdr_t, whose
+\c snap member and the histogram after it are the same as a snapshot
+file.
+
+\subsection fixed_rate Fixed-Rate Blocks
+
+Blocks normally follow each other as fast as analysis allows, or after a
+<tt>-p</tt> pause that drifts by however long the block and the sleep
+took, so outlier times are irregular samples.
+The <tt>--interval usec</tt> option instead starts each block on a
+deadline every \c usec microseconds, spinning on the TSC until the
+deadline, so the outlier series is uniformly sampled in time and
+periodicity found in it is sound.
+Deadlines stay on a fixed grid from the start of the run.
+When a stall makes a block start after one or more later deadlines have
+passed, those deadlines are counted as missed and skipped, and the
+block's lateness is still measured from the deadline it was waiting for,
+so the histogram shows the full length of the stall.
+
+After the statistics, the report gives the number of blocks started and
+deadlines missed, then a histogram of how late each block started after
+its deadline, with the same bins as the delta histogram.
+Lateness is normally the cost of one spin iteration; larger lateness
+means the CPU was taken away between blocks, which the deltas alone
+can't show.
+Timing covers a small fraction of the run in this mode, so the
+<tt>-r</tt> runtime may need to be longer to see rare events.
+
+\subsection coordinated_omission Coordinated Omission
+
+A paced run, with <tt>-p</tt> or <tt>--interval</tt>, stands in for
+requests arriving at a fixed rate.
+A long stall then hides every sample that would have been taken while
+it lasted, so the raw tail understates what a client arriving at that
+rate would see.
+The <tt>--correct</tt> option adds the missing samples to separate
+histograms and reports raw and corrected percentiles side by side.
+The expected interval is the <tt>--interval</tt>, or else the
+<tt>-p</tt> pause.
+Each delta longer than the expected interval adds one synthesized delta
+for each interval the stall lasted, each an interval shorter than the
+last.
+With <tt>--interval</tt>, each missed deadline also adds the lateness a
+block started on it would have had, starting with the block that did
+start, so one interval less for each deadline after the first.
+The histograms and statistics printed above stay raw.
+
+\subsection hypervisor Hypervisors
+
+Every report says whether the test ran under a hypervisor, found from
+the CPUID hypervisor bit and named from the vendor signature, and what a
+read of the TSC cost.
+Back to back reads take tens of ticks natively; a minimum delta of
+hundreds of ticks means the hypervisor traps and emulates
+<tt>rdtsc</tt>, which inflates every delta and hides short jitter.
+Under a hypervisor on Linux, the steal time that <tt>/proc/stat</tt>
+reports for the measured CPUs is shown too, as a share of the runtime
+and of the time lost to outliers.
+The measured CPUs are those given with <tt>-c</tt>, averaged if there
+are several, or else the CPU the test starts on.
+Steal explaining most of the time lost points at the host rather than
+the guest OS.
+Steal time is counted in clock ticks of the kernel, usually 10 ms, and
+may fall between blocks rather than in them, so the share of time lost
+is only shown when at least a tick was lost, and is capped at 100%.
+
+\subsection work Timing Work Units
+
+Applications don't read the TSC in a tight loop, and real work is
+disturbed in ways back to back timestamps are not: wide vector
+instructions can lower the core clock, big copies evict caches, and
+unusual instructions can need microcode assists.
+The <tt>--work</tt> option runs a fixed unit of work between timestamps,
+so each delta in the histogram is the time for one unit:
+
+\li <tt>hash:n</tt> n FNV-1a hashes of a 256 byte message (1)
+\li <tt>fma:n</tt> n rounds of 8 independent AVX-512 FMAs (100)
+\li <tt>parse:n</tt> parse n random signed decimal numbers, with a branch per character (16)
+\li <tt>memcpy:n</tt> copy n bytes (4096)
+
+Before testing, 1001 units are run to warm caches and branch
+predictors, then 1001 more are timed, and unless <tt>-m</tt> or
+<tt>-k</tt> is given, min is set to 9/10 of the fastest 1% and knee to
+3/2 of the median so the histogram fits the unit.
+
+\subsection audit Isolation Audit
+
+When a run looks bad, the usual suspects are checked by hand first.
+The <tt>--audit</tt> option checks them before measuring and reports them
+after the statistics, for the CPUs the test may run on, so use it with
+<tt>-c</tt>:
+
+\li <tt>isolcpus</tt> and <tt>nohz_full</tt>, as reported by sysfs, and
+<tt>rcu_nocbs</tt> and <tt>irqaffinity</tt> from the kernel command line,
+each with the measured CPUs it leaves out and what that means
+\li Interrupts whose <tt>/proc/irq/N/smp_affinity_list</tt> allows the
+measured CPUs
+\li kworker, RCU, and ksoftirqd threads that last ran on the measured
+CPUs
+\li Other tasks runnable on the measured CPUs, not counting the test
+
+\subsection frequency Effective Frequency
+
+The TSC ticks at a constant rate while the core clock follows turbo and
+power management, so the same code can take a different number of ticks
+from one second to the next.
+Bimodal deltas and the CPU speed line, which is the TSC rate, are hard to
+read without knowing what the core clock was doing.
+The <tt>--freq</tt> option samples the effective frequency of the CPU
+the test runs on every 100 ms from a helper thread and reports the
+minimum, mean, and maximum, the mean as a multiple of the TSC rate, and
+the number of transitions, changes of more than 2% between samples.
+Each sample is written to the file named by <tt>--freq</tt> as its end
+in ms relative to the start of the test and MHz.
+
+APERF and MPERF are read through <tt>/dev/cpu/N/msr</tt> when readable,
+usually as root with the msr module loaded.
+Their ratio gives the frequency the core actually ran at over each
+interval, but reading another CPU's registers interrupts it, so expect one
+small outlier per sample.
+Otherwise cpufreq's <tt>scaling_cur_freq</tt> is sampled, which is the
+frequency requested or last seen rather than an average.
+Neither is available in most virtual machines.
+
+\subsection cstates C-State Exit Latency
+
+Jitter on an idle system often comes from waking up: the deeper the
+C-state a core sleeps in, the longer it takes to come back.
+The <tt>--cstates</tt> option probes this instead of testing, idling the
+CPU for durations from 1 us to 100 ms, 21 times each, and timing each
+wakeup.
+Late is how long past the end of the idle the first timestamp was
+taken, and recovery is how much longer it took to get a block of
+timestamps with no delta above the knee.
+Unrecov counts the wakeups that got no such block within 100000 blocks;
+when that is most of them, recovery shows the limit instead of a time.
+The idle method is one of:
+
+\li <tt>sleep</tt> nanosleep(), letting the OS choose a C-state
+\li <tt>spin</tt> spin on pause, entering no C-state, as a baseline
+\li <tt>umwait</tt> umwait, entering C0.2 without the OS, on CPUs with WAITPKG
+
+On Linux, the cpuidle usage counts of the CPU are read around each
+duration, and the state entered most often is shown next to it along
+with the declared exit latencies of all states.
+If a BIOS setting limiting C-states took effect, deeper states never show
+up and lateness stays flat as the idle gets longer.
+Timer slack, 50 us by default, adds to every sleep, so use <tt>-T 1</tt>
+with <tt>sleep</tt>, and <tt>-c</tt> to probe a particular CPU.
+
+\subsection scan Scanning CPUs
+
+The <tt>--scan</tt> option measures every online CPU in turn instead of
+testing, for the runtime set with <tt>-r</tt> each, and ranks them
+quietest first by 99.99th percentile, then maximum, then time stolen by
+outliers.
+Socket, core, and SMT siblings are read from
+<tt>/sys/devices/system/cpu/cpuN/topology</tt>, so a quiet core whose
+sibling is noisy is easy to spot.
+Use <tt>-c</tt> to scan only some CPUs.
+CPUs are measured one at a time because CPUs sharing caches and memory
+disturb each other's results.
+Each measurement is the plain timing loop; use the chosen CPU with
+<tt>-c</tt> for the full report.
+
+\subsection library Recording Application Jitter
+
+<tt>make libsljtest.a</tt> builds a static library for timing sections
+of an application with exactly the same bins, statistics, and report
+format as sljtest, so application jitter and system jitter can be
+compared directly.
+The API in <tt>sljtest.h</tt> is <tt>slj_init()</tt> to set min, knee,
+bins, and outlier ring size like <tt>-m</tt>, <tt>-k</tt>, <tt>-b</tt>,
+and <tt>-o</tt>; <tt>slj_recorder_new()</tt> to make a recorder for each
+thread; <tt>slj_begin()</tt> and <tt>slj_end()</tt> around each section;
+and <tt>slj_report()</tt>, <tt>slj_save()</tt>, and
+<tt>slj_outliers()</tt> to look at one recorder or all of them merged.
+Each recorder is written only by its own thread without locks or atomic
+read-modify-writes, and read by any thread.
+Saved snapshots work with <tt>--load</tt> and <tt>--aggregate</tt>.
+Timing share in the report is time in sections over time since the
+first recorder was made, so it can exceed 100% with several threads.
+Only names starting with <tt>slj_</tt> are exported from the library.
+
+\subsection rollups Time Series Rollups
+
+The histogram of a long run shows how bad jitter gets, but not when.
+The <tt>--series</tt> option keeps rollups at three resolutions while
+the test runs: the last 1000 windows of 1 ms, 3600 of 1 s, and 1440 of
+1 min.
+For each window it keeps the largest delta, the 99.9th percentile, the
+number of outliers, and the time stolen by them, so a 1 ms stall every
+10 s stands out at 1 ms resolution while the 1 min windows show
+whether things got worse over hours.
+
+Windows are closed between blocks by differencing the histogram, so
+the only work in the timing loop is one comparison per block and one
+per outlier.
+The report shows the worst window at each resolution, and the file
+named by <tt>--series</tt> gets every window kept, oldest first, one
+per line as resolution, start in ms relative to the start of the test,
+length in ms, maximum, 99.9th percentile, outliers, and stolen time,
+all times but the first two in us.
+The last window of each resolution is usually partial.
+
+With <tt>--live</tt>, the worst window so far at each resolution is
+shown below the interval line, and with <tt>--shm</tt> the segment
+carries the number of windows closed and the last and worst window at
+each resolution, which <tt>--peek</tt> prints.
+Snapshots deliberately don't carry rollups: they hold whole-run results
+that can be merged across hosts, and windows from different runs have
+no common timeline to merge on, so the time series stays in the
+<tt>--series</tt> file.
+
 \subsection recommendations Recommended Test Parameters
 
 Design goals and constraints drove the decision to combine data collection and
@@ -1285,10 +8058,13 @@ Where \a x is the configured knee value.
 \section logging Logging and Plotting Outliers
 
 An outlier is defined as any TSC delta greater than the knee.  The <tt>-f</tt> option
-names a file where outliers will be written.  The format is \a x, \a y
+names a file where outliers will be written.  The format is \a x, \a y, \a p
 where \a x is the time of the outlier in ms relative to the start of
 the test and \a y is the size of the outlier in us.  Note the different
 units between axes.
+The time is when the outlying delta started, exact to the TSC tick, so
+it can be lined up with interrupt and kernel traces.
+\a p is the position of the delta in its block of timestamps, 0 to 9.
 
 The expectation is that you'll give this data to the graphing
 software of your choice and request an \a x \a y scatter plot.  Visual
@@ -1301,26 +8077,191 @@ jitter.
 Better yet, do an FFT on the data to move it from the time domain
 to the frequency domain.
 
+Outlier files can be re-analyzed later without a new test using
+<tt>--replay</tt>.
+Outliers are converted back to ticks and histogrammed with the
+current <tt>-b</tt>, <tt>-k</tt>, and <tt>-m</tt> settings, so old logs can be
+viewed with a new knee.
+Ticks per nanosecond are calibrated on the host doing the replay unless
+given with <tt>--tpns</tt>; use the CPU speed from the original run for
+exact results.
+The replay reports the time stolen by outliers above the knee in excess
+of the min setting.
+Outliers above the knee less than 1 ms apart are treated as one burst,
+and the replay reports the regularity of intervals between bursts and any
+period at which they recur.
+Large files are mapped and parsed in parallel chunks.
+
 Note that \a x may not be near zero if the outlier buffer wraps
 around.  If you're worried about the outlier buffer wrapping around,
 my advice is to increase the knee to classify fewer deltas as
 outliers rather than making the buffer bigger.  The default size
 is probably big enough for you to spot any periodic patterns.
 
+\subsection tracing Tracing Every Delta
+
+Some questions, like autocorrelation between deltas or patterns below
+the knee, need every delta rather than just the outliers.
+The <tt>--trace</tt> option records every delta to a compact binary file.
+The timing loop only copies each block of deltas into a ring of large
+chunks in memory.
+A writer thread running on a CPU not being measured encodes full chunks
+and writes them out.
+Typical deltas repeat a few values, so each chunk is Huffman coded with
+a code built for that chunk, with runs of a repeated delta and large
+deltas coded separately.
+A quiet system usually needs 2 to 3 bits per delta, a few MB per second.
+If the writer can't keep up, whole chunks are dropped instead of
+stalling the timing loop, and the number dropped is reported.
+
+The <tt>--dump-trace</tt> option prints a trace file as text, one delta
+in ticks per line, for the analysis tool of your choice.
+Every 10 consecutive deltas came from one block of timestamps; the time
+spent on analysis between blocks is not in the trace.
+A comment line marks where deltas were dropped.
+
+\subsection flight Flight Recorder
+
+Rare large outliers are the hardest to explain, since by the time a
+test ends there is nothing left to look at but their time and size.
+The <tt>--trigger</tt> option sets a delta size in ticks, above the knee,
+that triggers a flight record.
+The timing loop keeps the most recent deltas in a small ring.
+When a delta exceeds the trigger, the 1000 deltas before it and the
+1000 after it (set with <tt>--context</tt>) are saved.
+
+A helper thread keeps snapshots of <tt>/proc/interrupts</tt>,
+<tt>/proc/self/schedstat</tt>, and <tt>/proc/stat</tt> no more than
+about 10 ms old, and takes new ones as soon as it sees a trigger.
+It writes each record to the file named by <tt>--record</tt>
+(<tt>sljtest-flight.txt</tt> by default) while the test runs.
+A record shows the saved deltas one block per line with the trigger
+marked, the interrupts taken on the measured CPU between the snapshots,
+the run time, wait time, and timeslices of the timing thread, and the
+measured CPU's time by category.
+Up to 8 records can wait to be written; triggers while they are all
+busy are counted as skipped.
+
+The helper thread runs on CPUs not being measured, so pin the test with
+<tt>-c</tt> and leave at least one other CPU free.
+Otherwise the helper runs on the measured CPU and its own work shows
+up as outliers.
+
+\section snapshots Saving and Loading Snapshots
+
+The <tt>--save</tt> option writes the results of a run to a binary
+snapshot file.
+A snapshot holds the histogram bin layout, counts, and sums, the overall
+statistics with exact sums for the moments, the measured ticks per
+nanosecond, the host name, CPU number and model, and the command line.
+
+The <tt>--load</tt> option reports on a snapshot with exactly the same
+output as the run that saved it, followed by where and when it was taken.
+The <tt>-s</tt> and <tt>-w</tt> options still apply when loading, but
+histogram settings come from the snapshot.
+Snapshot files are mapped into memory and used in place without parsing.
+They use the byte order of the x86 machine that wrote them.
+
+The <tt>--aggregate</tt> option merges every <tt>*.slj</tt> snapshot in a
+directory into one fleet histogram and statistics.
+Snapshots with histogram settings different from the rest are skipped
+and counted.
+Since histograms are kept in TSC ticks, snapshots whose measured TSC
+rate is more than 1% from the rest are also skipped and counted, so
+every merged bin holds the same range of times.
+Per-host rankings below still include skipped snapshots, each converted
+with its own TSC rate.
+Each file is read by its own thread and histograms are merged in a
+binary tree so large fleets aggregate quickly.
+
+After the fleet histogram come tables of the worst hosts and cores
+ranked by 99.99th percentile, maximum, and stolen time.
+Stolen time is the time taken by deltas above the knee in excess of the
+minimum delta, as a percentage of runtime.
+Percentiles are the upper bound of the histogram bin where they fall.
+Finally, any host and core whose robust z-score on a metric is above
+3.5 is flagged as an outlier.
+Robust z-scores use the median and median absolute deviation of the
+fleet, so a few bad hosts can't hide by inflating the spread.
+
+
+\section memory Memory Setup
+
+The first touch of each page of memory causes a page fault that can
+take several microseconds.
+If that happens while timing, SLJ Test's own setup shows up as an outlier.
+So every buffer touched by the timing loop is written once before
+timing starts.
+
+The <tt>-l</tt> option locks all memory with \c mlockall() so no page
+can be swapped out during the test.
+The <tt>-H</tt> option backs buffers with explicit huge pages when the
+system has some reserved, and asks for transparent huge pages otherwise.
+With either option, SLJ Test reports what it was able to get.
+Any page faults taken while timing are counted and reported with the
+overall statistics.
+
+\section realtime Real-Time Scheduling and CPU Affinity
+
+On Linux, SLJ Test can pin itself to CPUs and raise its own scheduling
+priority instead of being wrapped in \c taskset and \c chrt.
+The <tt>-c</tt> option sets CPU affinity and <tt>-S</tt> sets the
+scheduling policy to \c SCHED_FIFO, \c SCHED_RR, or \c SCHED_OTHER.
+A real-time policy also turns on <tt>-l</tt> and sets the timer slack
+to 1 ns unless <tt>-T</tt> says otherwise.
+Affinity is set before any buffers are allocated so their memory comes
+from the NUMA node of the measured CPU.
+
+The affinity, policy, priority, and timer slack in effect are read back
+and reported, so the output records what the test actually ran with.
+Raising priority usually requires root, \c CAP_SYS_NICE, or an
+\c rtprio limit; failures are reported with the reason.
+
 
 \section options Command Line Options
 
 \verbatim
+ --aggregate dir	Merge and rank all snapshot (*.slj) files in dir instead of testing
+ --audit	Report isolcpus, nohz_full, IRQs, and tasks on the measured CPUs (Linux only)
  -b bins	Set the number of Bins in the histogram (20)
+ --context n	Deltas saved before and after each flight recorder trigger (1000)
+ --correct	Report percentiles corrected for coordinated omission with -p or --interval
+ -c cpu		Run on CPUs in list like 2 or 0,4-7 (Linux only, no affinity set)
+ --cstates method	Probe C-state exit latency idling by sleep, spin, or umwait instead of testing
+ --events file	Name of file for interruption events to be written (no file written)
+ --dump-trace file	Print every delta in a trace file written by --trace instead of testing
  -f outfile	Name of file for outlier data to be written (no file written)
+ --freq file	Sample effective frequency and write it to file (Linux only, not sampled)
+ --gap ticks	Merge outliers closer than this into one interruption event (1000)
  -h		Print Help
+ --kernel name	Analysis kernel scalar, avx2, or avx512 (best supported by CPU)
+ --live		Redraw the histogram live every second while testing
+ --load file	Load a snapshot file and report on it instead of testing
+ -H		Back buffers with Huge pages, explicit if reserved, else transparent
+ --interval usec	Start each block on a fixed-rate TSC deadline usec apart (back to back)
  -k knee	Set the histogram Knee value in TSC ticks (50)
+ -l		Lock all memory with mlockall() before timing
  -m min		Set the Minimum expected value in TSC ticks (10)
  -o outbuf	Size of outlier buffer in outliers (10000)
  -p pause	Pause msecs just before starting jitter test loop (0)
+ --peek name	Report on a shared memory segment written by --shm instead of testing
+ -P priority	Real-time Priority for -S fifo or rr, implies -S fifo (50)
+ --record file	Name of file for flight records to be written (sljtest-flight.txt)
  -r runtime	Run jitter testing loops until seconds pass (1)
+ --replay file	Re-analyze an outlier file written by -f instead of testing
+ --save file	Save results in a binary snapshot file (no file written)
  -s		Sum deltas falling into each bin (instead of just counting deltas falling into bin)
+ --scan		Measure and rank every CPU for runtime each instead of testing (Linux only)
+ -S sched	Scheduling policy fifo, rr, or other (Linux only, policy unchanged)
+ --selftest-bench	Benchmark the analysis engine on synthetic streams instead of testing
+ --series file	Keep 1 ms, 1 s, and 1 min rollups and write them to file (none kept)
+ --shm name	Publish results every 10 ms in a shared memory segment like /sljtest (none)
+ -T slack	Timer slack in nanoseconds, at least 1 (Linux only, 1 with -S fifo or rr)
+ --tpns ticks	TSC ticks per nanosecond for --replay (calibrated on this host)
+ --trace file	Record every delta in a compact trace file (no file written)
+ --trigger ticks	Save a flight record around each delta above ticks (no records)
  -w width	Output line Width in characters (80)
+ --work unit	Time a work unit hash, fma, parse, or memcpy, with optional :n, between timestamps (none)
 \endverbatim
 
 \section examples Example Output
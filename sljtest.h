@@ -0,0 +1,110 @@
+/**
+
+\file   sljtest.h
+\brief  libsljtest: record application jitter in SLJ Test's bins and formats
+
+Timed sections of an application are binned exactly like the deltas of
+sljtest, so application jitter and system jitter can be compared directly,
+in the same report format or as snapshot files for sljtest --load and
+--aggregate.
+
+Build with "make libsljtest.a" and link with -lsljtest -lm -lpthread -lrt.
+Only names starting with slj_ are exported.
+
+\code
+	slj_init(10, 50, 20, 1000);
+	slj_recorder_t *rec = slj_recorder_new("feed");	// In each thread
+
+	uint64_t t = slj_begin();
+	handle_message();
+	slj_end(rec, t);
+
+	slj_report(NULL);		// All recorders merged
+	slj_save(NULL, "feed.slj");
+\endcode
+
+*/
+
+#ifndef	SLJTEST_H
+#define	SLJTEST_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*! Recorder owned by one thread, read lock-free by any other */
+typedef struct slj_recorder_stct slj_recorder_t;
+
+/*!
+ * \brief Set up histogram bins and calibrate the TSC, once before any recorder
+ * \param min      Minimum expected section time (ticks), like sljtest -m
+ * \param knee     Knee between linear and logarithmic bins (ticks), like -k
+ * \param bins     Number of histogram bins, like -b
+ * \param outliers Recent sections above the knee kept per recorder, like -o
+ * \return 0 if set up, -1 if the settings are unusable
+ */
+int slj_init(uint64_t min, uint64_t knee, uint64_t bins, size_t outliers);
+
+/*!
+ * \brief Create a recorder for the calling thread
+ * \param name Name used in reports
+ * \return Recorder, or NULL if out of memory
+ *
+ * Recorders live until the process exits.
+ */
+slj_recorder_t *slj_recorder_new(const char *name);
+
+/*!
+ * \brief Record a section time, only from the thread owning the recorder
+ * \param rp    Recorder
+ * \param when  TSC at the start of the section
+ * \param delta Section time (ticks)
+ */
+void slj_record(slj_recorder_t *rp, uint64_t when, uint64_t delta);
+
+/*!
+ * \brief Copy the most recent sections above the knee, newest first
+ * \param rp    Recorder
+ * \param when  Receives TSC at the start of each
+ * \param delta Receives each section time (ticks)
+ * \param n     Most to copy
+ * \return Number copied
+ */
+size_t slj_outliers(const slj_recorder_t *rp, uint64_t *when, uint64_t *delta, size_t n);
+
+/*!
+ * \brief Print histogram and statistics in sljtest's format
+ * \param rp Recorder, or NULL for all recorders merged
+ */
+void slj_report(const slj_recorder_t *rp);
+
+/*!
+ * \brief Save a snapshot file readable by sljtest --load and --aggregate
+ * \param rp   Recorder, or NULL for all recorders merged
+ * \param path Name of snapshot file
+ * \return 0 if saved, -1 otherwise
+ */
+int slj_save(const slj_recorder_t *rp, const char *path);
+
+/*!
+ * \brief Start timing a section
+ * \return TSC now
+ */
+static inline uint64_t
+slj_begin(void) {
+	uint32_t hi, lo;
+
+	__asm__ volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t)hi << 32 | lo);
+}
+
+/*!
+ * \brief End timing a section and record it
+ * \param rp    Recorder of the calling thread
+ * \param begin TSC from slj_begin()
+ */
+static inline void
+slj_end(slj_recorder_t *rp, uint64_t begin) {
+	slj_record(rp, begin, slj_begin()-begin);
+}
+
+#endif	/* SLJTEST_H */